@@ -0,0 +1,155 @@
+// @Author Wang Xin
+
+#include "BodySink.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "HttpData.h"
+#include "base/Logging.h"
+
+size_t SpillBuffer::memoryLimit_ = 1024 * 1024;
+std::string SpillBuffer::spillDir_;
+
+SpillBuffer::~SpillBuffer() {
+  if (fd_ >= 0) close(fd_);
+}
+
+bool SpillBuffer::append(const char *data, size_t len) {
+  if (fd_ < 0 && memory_.size() + len <= memoryLimit_) {
+    memory_.append(data, len);
+    size_ += len;
+    return true;
+  }
+  if (fd_ < 0 && !spill()) return false;
+  while (len > 0) {
+    ssize_t n = write(fd_, data, len);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      LOG << "write spill file failed: " << strerror(errno);
+      return false;
+    }
+    data += n;
+    len -= n;
+    size_ += n;
+  }
+  return true;
+}
+
+// 建一个临时文件，把内存里已有的内容先写进去
+bool SpillBuffer::spill() {
+  if (spillDir_.empty()) return false;
+  int fd = open(spillDir_.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    // 文件系统不支持O_TMPFILE时退回mkstemp再unlink
+    std::string path = spillDir_ + "/body.XXXXXX";
+    fd = mkostemp(&path[0], O_CLOEXEC);
+    if (fd >= 0) unlink(path.c_str());
+  }
+  if (fd < 0) {
+    LOG << "create spill file in " << spillDir_ << " failed: " << strerror(errno);
+    return false;
+  }
+  fd_ = fd;
+  std::string buffered;
+  buffered.swap(memory_);
+  size_ = 0;
+  return append(buffered.data(), buffered.size());
+}
+
+std::map<std::string, BodyHandlers::Factory> &BodyHandlers::handlers() {
+  static std::map<std::string, Factory> handlers;
+  return handlers;
+}
+
+void BodyHandlers::add(const std::string &path, const Factory &factory) {
+  handlers()[path] = factory;
+}
+
+BodySink *BodyHandlers::create(const std::string &path, HttpData *conn) {
+  std::map<std::string, Factory> &all = handlers();
+  std::map<std::string, Factory>::const_iterator it = all.find(path);
+  return it == all.end() ? NULL : it->second(conn);
+}
+
+namespace {
+
+// POST /echo：把请求体原样发回去，边收边发，响应用chunked编码。
+// 响应头等到第一段数据到了再发，排在"100 Continue"后面
+class EchoSink : public BodySink {
+ public:
+  explicit EchoSink(HttpData *conn) : conn_(conn), started_(false) {}
+
+  int onData(const char *data, size_t len) {
+    start();
+    conn_->appendChunk(data, len);
+    return 0;
+  }
+  void onComplete() {
+    start();
+    conn_->endChunkedResponse();
+  }
+
+ private:
+  void start() {
+    if (started_) return;
+    started_ = true;
+    StringPiece type = conn_->requestHeaders().get(HEADER_CONTENT_TYPE);
+    conn_->beginChunkedResponse(
+        std::string("HTTP/1.1 200 OK\r\nContent-Type: ") +
+        (type.empty() ? std::string("application/octet-stream")
+                      : type.as_string()) +
+        "\r\n");
+  }
+
+  HttpData *conn_;
+  bool started_;
+};
+
+// POST /upload：收下请求体(大的落盘)，回长度和CRC32，给上传大文件的客户端做校验
+class UploadSink : public BodySink {
+ public:
+  explicit UploadSink(HttpData *conn) : conn_(conn), crc_(crc32(0, NULL, 0)) {}
+
+  int onStart(size_t length) {
+    if (length != kUnknownLength && !SpillBuffer::fits(length)) return 413;
+    return 0;
+  }
+  int onData(const char *data, size_t len) {
+    if (!body_.append(data, len))
+      return SpillBuffer::fits(body_.size() + len) ? 500 : 413;
+    crc_ = crc32(crc_, reinterpret_cast<const Bytef *>(data),
+                 static_cast<uInt>(len));
+    return 0;
+  }
+  void onComplete() {
+    char text[128];
+    snprintf(text, sizeof text, "received %zu bytes, crc32 %08lx, %s\n",
+             body_.size(), static_cast<unsigned long>(crc_),
+             body_.spilled() ? "spilled to disk" : "in memory");
+    conn_->appendResponse("200 OK", "text/plain", text);
+  }
+
+ private:
+  HttpData *conn_;
+  SpillBuffer body_;
+  uLong crc_;
+};
+
+BodySink *newEchoSink(HttpData *conn) { return new EchoSink(conn); }
+BodySink *newUploadSink(HttpData *conn) { return new UploadSink(conn); }
+
+// 内置的处理程序在main之前注册好
+struct BuiltinHandlers {
+  BuiltinHandlers() {
+    BodyHandlers::add("/echo", &newEchoSink);
+    BodyHandlers::add("/upload", &newUploadSink);
+  }
+};
+
+const BuiltinHandlers kBuiltinHandlers;
+
+}  // namespace
@@ -0,0 +1,81 @@
+// @Author Wang Xin
+
+#pragma once
+#include <stddef.h>
+#include <functional>
+#include <map>
+#include <string>
+#include "base/noncopyable.h"
+
+class HttpData;
+
+/*
+请求体的接收者。处理程序按路径注册一个工厂，请求头收完后HttpData为这个请求创建一个BodySink，
+请求体边收边交给它(chunked的块头已经去掉)，不在inBuffer_里攒成一整块。
+onStart和onData返回0表示继续，否则是要回给客户端的错误状态码(比如413)，之后连接会关闭；
+响应已经开始发了的话没法再回错误页，只能直接关闭连接。
+sink通过HttpData的appendResponse/beginChunkedResponse等接口回响应，回调都在连接所在的EventLoop线程里
+*/
+class BodySink : noncopyable {
+ public:
+  static const size_t kUnknownLength = static_cast<size_t>(-1);
+
+  virtual ~BodySink() {}
+  // 请求体到来之前调用，length是Content-Length，chunked时为kUnknownLength
+  virtual int onStart(size_t length) {
+    (void)length;
+    return 0;
+  }
+  virtual int onData(const char *data, size_t len) = 0;
+  // 请求体收完了，由它生成响应
+  virtual void onComplete() = 0;
+};
+
+class BodyHandlers {
+ public:
+  typedef std::function<BodySink *(HttpData *conn)> Factory;
+  // path按请求的路径精确匹配，比如"/upload"；必须在EventLoop线程启动之前调用
+  static void add(const std::string &path, const Factory &factory);
+  // 没有注册这个路径时返回NULL，返回的对象由调用者释放
+  static BodySink *create(const std::string &path, HttpData *conn);
+
+ private:
+  static std::map<std::string, Factory> &handlers();
+};
+
+/*
+请求体的存放处：不超过内存上限时放在内存里，超过后整体转到一个临时文件里接着写。
+临时文件创建后马上unlink，关闭就删掉，进程异常退出也不会留下垃圾。没设置临时文件目录时超过内存上限就放不下了
+*/
+class SpillBuffer : noncopyable {
+ public:
+  SpillBuffer() : fd_(-1), size_(0) {}
+  ~SpillBuffer();
+
+  // 放不下(超过上限，或者写临时文件出错)时返回false
+  bool append(const char *data, size_t len);
+  size_t size() const { return size_; }
+  bool spilled() const { return fd_ >= 0; }
+  // 没转到文件时的内容
+  const std::string &memory() const { return memory_; }
+  // 转到文件后的fd，内容从偏移0开始；没转时为-1
+  int fd() const { return fd_; }
+
+  // 这么长的请求体能不能放下，预先知道长度时用来提前拒绝
+  static bool fits(size_t len) { return len <= memoryLimit_ || !spillDir_.empty(); }
+  // 必须在EventLoop线程启动之前调用，spillDir为空表示不落盘
+  static void setOptions(size_t memoryLimit, const std::string &spillDir) {
+    memoryLimit_ = memoryLimit;
+    spillDir_ = spillDir;
+  }
+
+ private:
+  bool spill();
+
+  std::string memory_;
+  int fd_;
+  size_t size_;
+
+  static size_t memoryLimit_;
+  static std::string spillDir_;
+};
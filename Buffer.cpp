@@ -0,0 +1,49 @@
+// @Author Wang Xin
+
+#include "Buffer.h"
+#include <errno.h>
+#include <sys/uio.h>
+
+const size_t Buffer::kCheapPrepend;
+const size_t Buffer::kInitialSize;
+
+ssize_t Buffer::readFd(int fd, int *savedErrno) {
+  /*
+  用readv同时读进缓冲区剩余空间和栈上64KB的extrabuf：缓冲区不用预先开得很大，
+  一次系统调用也能读到足够多的数据，读到extrabuf里的部分再append进缓冲区
+  */
+  char extrabuf[65536];
+  struct iovec vec[2];
+  const size_t writable = writableBytes();
+  vec[0].iov_base = begin() + writerIndex_;
+  vec[0].iov_len = writable;
+  vec[1].iov_base = extrabuf;
+  vec[1].iov_len = sizeof extrabuf;
+  // 缓冲区剩余空间已经比extrabuf大时，就不用extrabuf了
+  const int iovcnt = (writable < sizeof extrabuf) ? 2 : 1;
+  const ssize_t n = readv(fd, vec, iovcnt);
+  if (n < 0) {
+    *savedErrno = errno;
+  } else if (static_cast<size_t>(n) <= writable) {
+    writerIndex_ += n;
+  } else {
+    writerIndex_ = buffer_.size();
+    append(extrabuf, n - writable);
+  }
+  return n;
+}
+
+void Buffer::makeSpace(size_t len) {
+  if (writableBytes() + prependableBytes() < len + kCheapPrepend) {
+    buffer_.resize(writerIndex_ + len);
+  } else {
+    // 前面已经读走的空间够用，把可读数据挪到前面，不用重新分配内存
+    assert(kCheapPrepend < readerIndex_);
+    size_t readable = readableBytes();
+    std::copy(begin() + readerIndex_, begin() + writerIndex_,
+              begin() + kCheapPrepend);
+    readerIndex_ = kCheapPrepend;
+    writerIndex_ = readerIndex_ + readable;
+    assert(readable == readableBytes());
+  }
+}
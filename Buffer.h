@@ -0,0 +1,114 @@
+// @Author Wang Xin
+
+#pragma once
+#include <assert.h>
+#include <string.h>
+#include <sys/types.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+/*
+网络IO用的缓冲区，参照muduo的Buffer:
++-------------------+------------------+------------------+
+| prependable bytes |  readable bytes  |  writable bytes  |
+|                   |     (CONTENT)    |                  |
++-------------------+------------------+------------------+
+0      <=      readerIndex   <=   writerIndex    <=     size
+读走数据只是移动readerIndex_，不会像std::string::substr那样把剩下的数据整体拷贝一遍
+*/
+class Buffer {
+ public:
+  static const size_t kCheapPrepend = 8;
+  static const size_t kInitialSize = 1024;
+
+  explicit Buffer(size_t initialSize = kInitialSize)
+      : buffer_(kCheapPrepend + initialSize),
+        readerIndex_(kCheapPrepend),
+        writerIndex_(kCheapPrepend) {}
+
+  size_t readableBytes() const { return writerIndex_ - readerIndex_; }
+  size_t writableBytes() const { return buffer_.size() - writerIndex_; }
+  size_t prependableBytes() const { return readerIndex_; }
+
+  const char *peek() const { return begin() + readerIndex_; }
+  const char *beginRead() const { return peek(); }
+  const char *endRead() const { return begin() + writerIndex_; }
+
+  // 从start开始找"\r\n"，找不到返回NULL
+  const char *findCRLF(const char *start) const {
+    assert(peek() <= start && start <= endRead());
+    const char kCRLF[] = "\r\n";
+    const char *crlf = std::search(start, endRead(), kCRLF, kCRLF + 2);
+    return crlf == endRead() ? NULL : crlf;
+  }
+  const char *findCRLF() const { return findCRLF(peek()); }
+
+  void retrieve(size_t len) {
+    assert(len <= readableBytes());
+    if (len < readableBytes())
+      readerIndex_ += len;
+    else
+      retrieveAll();
+  }
+  void retrieveUntil(const char *end) {
+    assert(peek() <= end && end <= endRead());
+    retrieve(end - peek());
+  }
+  void retrieveAll() {
+    readerIndex_ = kCheapPrepend;
+    writerIndex_ = kCheapPrepend;
+  }
+  std::string retrieveAsString(size_t len) {
+    assert(len <= readableBytes());
+    std::string result(peek(), len);
+    retrieve(len);
+    return result;
+  }
+  std::string retrieveAllAsString() {
+    return retrieveAsString(readableBytes());
+  }
+
+  void append(const char *data, size_t len) {
+    ensureWritableBytes(len);
+    std::copy(data, data + len, beginWrite());
+    hasWritten(len);
+  }
+  void append(const std::string &str) { append(str.data(), str.size()); }
+
+  void ensureWritableBytes(size_t len) {
+    if (writableBytes() < len) makeSpace(len);
+    assert(writableBytes() >= len);
+  }
+  char *beginWrite() { return begin() + writerIndex_; }
+  void hasWritten(size_t len) {
+    assert(len <= writableBytes());
+    writerIndex_ += len;
+  }
+
+  // 在可读数据前面插入数据，比如先写好body再补上长度
+  void prepend(const void *data, size_t len) {
+    assert(len <= prependableBytes());
+    readerIndex_ -= len;
+    const char *d = static_cast<const char *>(data);
+    std::copy(d, d + len, begin() + readerIndex_);
+  }
+
+  void swap(Buffer &rhs) {
+    buffer_.swap(rhs.buffer_);
+    std::swap(readerIndex_, rhs.readerIndex_);
+    std::swap(writerIndex_, rhs.writerIndex_);
+  }
+
+  // 直接从fd读数据到缓冲区，返回值同read，出错时errno保存在*savedErrno中
+  ssize_t readFd(int fd, int *savedErrno);
+
+ private:
+  char *begin() { return &*buffer_.begin(); }
+  const char *begin() const { return &*buffer_.begin(); }
+  void makeSpace(size_t len);
+
+  std::vector<char> buffer_;
+  size_t readerIndex_;
+  size_t writerIndex_;
+};
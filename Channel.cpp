@@ -15,10 +15,10 @@
 using namespace std;
 
 Channel::Channel(EventLoop *loop)//默认的监听事件是0
-    : loop_(loop), fd_(0) , events_(0), lastEvents_(0){}
+    : loop_(loop), fd_(0) , events_(0), lastEvents_(0), listening_(false){}
 
 Channel::Channel(EventLoop *loop, int fd)//默认的监听事件是0
-    : loop_(loop), fd_(fd), events_(0), lastEvents_(0) {}
+    : loop_(loop), fd_(fd), events_(0), lastEvents_(0), listening_(false) {}
 
 Channel::~Channel() {
     /* loop_->poller_->epoll_del(fd, events_); */
@@ -25,6 +25,7 @@ channel会把不同的IO事件分发给不同的回调函数，例如Readcallbak
   __uint32_t events_;//这个channel要监听的事件，可能是多个事件的组合
   __uint32_t revents_;//这个channel监听到的事件，即活跃的事件，可能是多个事件的组合
   __uint32_t lastEvents_;//这个channel上次监听的事件
+  bool listening_;// 监听socket，Poller可以替它accept
 
   // 方便找到上层持有该Channel的对象，即HttpData对象
   std::weak_ptr<HttpData> holder_;
@@ -99,6 +100,7 @@ EPOLLHUP 表示读写都关闭。
   void handleConn();
 
   void setRevents(__uint32_t ev) { revents_ = ev; }
+  __uint32_t getRevents() const { return revents_; }
 
   void setEvents(__uint32_t ev) { events_ = ev; }
   __uint32_t &getEvents() { return events_; }
@@ -110,6 +112,10 @@ EPOLLHUP 表示读写都关闭。
   }
 
   __uint32_t getLastEvents() { return lastEvents_; }
+
+  // 必须在加入Poller之前设置
+  void setListening(bool on) { listening_ = on; }
+  bool isListening() const { return listening_; }
 };
 
 typedef std::shared_ptr<Channel> SP_Channel;
@@ -0,0 +1,80 @@
+// @Author Wang Xin
+
+#include "ContentCache.h"
+#include "base/Logging.h"
+
+const int ContentCache::kVariants;
+const off_t ContentCache::kMaxFileSize;
+const int ContentCache::kShards;
+
+ContentCache &ContentCache::instance() {
+  static ContentCache cache;
+  return cache;
+}
+
+static bool sameVersion(ino_t ino, off_t size, const struct timespec &mtime,
+                        const struct stat &st) {
+  return ino == st.st_ino && size == st.st_size &&
+         mtime.tv_sec == st.st_mtim.tv_sec &&
+         mtime.tv_nsec == st.st_mtim.tv_nsec;
+}
+
+ContentCache::ResponsePtr ContentCache::get(const std::string &path,
+                                            int variant,
+                                            const struct stat &st) {
+  Shard &shard = shardOf(path);
+  {
+    MutexLockGuard lock(shard.mutex);
+    std::unordered_map<std::string, LruList::iterator>::iterator it =
+        shard.index[variant].find(path);
+    if (it != shard.index[variant].end()) {
+      LruList::iterator entry = it->second;
+      if (sameVersion(entry->ino, entry->size, entry->mtime, st)) {
+        shard.lru.splice(shard.lru.begin(), shard.lru, entry);
+        hits_.fetch_add(1, std::memory_order_relaxed);
+        return entry->response;
+      }
+      erase(shard, entry);// 文件已经变了
+    }
+  }
+  long misses = misses_.fetch_add(1, std::memory_order_relaxed) + 1;
+  if ((misses & 0xffff) == 0)
+    LOG << "Content cache: hits " << hits() << ", misses " << misses
+        << ", evictions " << evictions();
+  return ResponsePtr();
+}
+
+void ContentCache::put(const std::string &path, int variant,
+                       const struct stat &st, const ResponsePtr &response) {
+  Shard &shard = shardOf(path);
+  const size_t budget = capacity_ / kShards;
+  Entry entry;
+  entry.path = path;
+  entry.variant = variant;
+  entry.ino = st.st_ino;
+  entry.size = st.st_size;
+  entry.mtime = st.st_mtim;
+  entry.response = response;
+  const size_t bytes = bytesOf(entry);
+  if (bytes > budget) return;
+
+  MutexLockGuard lock(shard.mutex);
+  // 其他线程可能刚刚放进去了同一个文件的响应，用新的替换掉
+  std::unordered_map<std::string, LruList::iterator>::iterator it =
+      shard.index[variant].find(path);
+  if (it != shard.index[variant].end()) erase(shard, it->second);
+  while (shard.bytes + bytes > budget) {
+    erase(shard, --shard.lru.end());
+    evictions_.fetch_add(1, std::memory_order_relaxed);
+  }
+  shard.lru.push_front(entry);
+  shard.index[variant][path] = shard.lru.begin();
+  shard.bytes += bytes;
+}
+
+void ContentCache::erase(Shard &shard, LruList::iterator it) {
+  shard.bytes -= bytesOf(*it);
+  shard.index[it->variant].erase(it->path);
+  // 正在发送的连接还持有response的引用，这里只是从缓存中摘掉
+  shard.lru.erase(it);
+}
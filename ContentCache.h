@@ -0,0 +1,78 @@
+// @Author Wang Xin
+
+#pragma once
+#include <sys/stat.h>
+#include <atomic>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include "base/MutexLock.h"
+#include "base/noncopyable.h"
+
+/*
+所有EventLoop共享的热点小文件缓存，缓存的是拼好的完整响应(状态行、头部和文件内容)。
+命中时把不可变的响应以shared_ptr挂到连接的输出队列上，一次sendmsg发出，不再拼字符串，也不读文件。
+按key的哈希分成kShards段，每段一把锁、一个LRU链表，各段分摊总内存预算，查找时不存在全局锁。
+同一个文件因为请求头不同可能有多个版本的响应(是否Keep-Alive、是否gzip)，用variant区分。
+条目记下生成时文件的inode、大小和mtime，调用方用FileCache里的stat结果校验，文件变了就当作未命中
+*/
+class ContentCache : noncopyable {
+ public:
+  typedef std::shared_ptr<const std::string> ResponsePtr;
+  // 第0位: Keep-Alive，第1位: 客户端接受gzip。同一个variant下缓存的响应不一定是压缩过的，比如图片
+  static const int kVariants = 4;
+  static const off_t kMaxFileSize = 256 * 1024;// 更大的文件用sendfile发送，不占缓存
+
+  static ContentCache &instance();
+
+  // 总内存预算，0表示不缓存，必须在EventLoop线程启动之前调用
+  void setCapacity(size_t bytes) { capacity_ = bytes; }
+  bool cacheable(off_t fileSize) const {
+    return capacity_ > 0 && fileSize <= kMaxFileSize;
+  }
+
+  // 没有缓存或者缓存的版本和st对不上时返回空指针
+  ResponsePtr get(const std::string &path, int variant, const struct stat &st);
+  void put(const std::string &path, int variant, const struct stat &st,
+           const ResponsePtr &response);
+
+  long hits() const { return hits_.load(std::memory_order_relaxed); }
+  long misses() const { return misses_.load(std::memory_order_relaxed); }
+  long evictions() const { return evictions_.load(std::memory_order_relaxed); }
+
+ private:
+  static const int kShards = 16;
+
+  struct Entry {
+    std::string path;
+    int variant;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    ResponsePtr response;
+  };
+  typedef std::list<Entry> LruList;
+  struct Shard {
+    MutexLock mutex;
+    LruList lru;// 表头是最近用过的
+    std::unordered_map<std::string, LruList::iterator> index[kVariants];
+    size_t bytes;
+    Shard() : bytes(0) {}
+  };
+
+  ContentCache() : capacity_(64 * 1024 * 1024), hits_(0), misses_(0), evictions_(0) {}
+  Shard &shardOf(const std::string &path) {
+    return shards_[std::hash<std::string>()(path) % kShards];
+  }
+  static size_t bytesOf(const Entry &entry) {
+    return entry.path.size() + entry.response->size();
+  }
+  void erase(Shard &shard, LruList::iterator it);
+
+  size_t capacity_;
+  Shard shards_[kShards];
+  std::atomic<long> hits_;
+  std::atomic<long> misses_;
+  std::atomic<long> evictions_;
+};
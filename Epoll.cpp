@@ -32,19 +32,15 @@ Epoll::~Epoll() {
 }
 
 // 注册新描述符
-void Epoll::epoll_add(SP_Channel request, int timeout) {
+void Epoll::addChannel(SP_Channel request, int timeout) {
   int fd = request->getFd();
-  if (timeout > 0) {
-    add_timer(request, timeout);
-    fd2http_[fd] = request->getHolder();
-  }
+  registerChannel(request, timeout);
   struct epoll_event event;
   event.data.fd = fd;
   event.events = request->getEvents();
 
   request->EqualAndUpdateLastEvents();
 
-  fd2chan_[fd] = request;
   if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &event) < 0) {
     perror("epoll_add error");
     fd2chan_[fd].reset();// 智能指针的引用计数减一，如果引用计数为0，那么释放对象
@@ -52,7 +48,7 @@ void Epoll::epoll_add(SP_Channel request, int timeout) {
 }
 
 // 修改描述符状态
-void Epoll::epoll_mod(SP_Channel request, int timeout) {
+void Epoll::modChannel(SP_Channel request, int timeout) {
   if (timeout > 0) add_timer(request, timeout);
   int fd = request->getFd();
   if (!request->EqualAndUpdateLastEvents()) {
@@ -67,7 +63,7 @@ void Epoll::epoll_mod(SP_Channel request, int timeout) {
 }
 
 // 从epoll中删除描述符
-void Epoll::epoll_del(SP_Channel request) {
+void Epoll::delChannel(SP_Channel request) {
   int fd = request->getFd();
   struct epoll_event event;
   event.data.fd = fd;
@@ -77,23 +73,23 @@ void Epoll::epoll_del(SP_Channel request) {
   if (epoll_ctl(epollFd_, EPOLL_CTL_DEL, fd, &event) < 0) {
     perror("epoll_del error");
   }
-  fd2chan_[fd].reset();
-  fd2http_[fd].reset();
+  unregisterChannel(fd);
 }
 
 // 监听这个线程上设置的所有事件，只要有事件就绪就返回，返回所有活跃事件对应的channel。poll()会在loop函数中被调用，loop函数会调用所有channel的回调函数，所以poll()函数的作用就是监听，并处理就绪事件
 std::vector<SP_Channel> Epoll::poll() {
   while (true) {
+    int waitTime = timerManager_.nextTimeout(EPOLLWAIT_TIME);
     int event_count =
-        epoll_wait(epollFd_, &*events_.begin(), events_.size(), EPOLLWAIT_TIME);
+        epoll_wait(epollFd_, &*events_.begin(), events_.size(), waitTime);
     if (event_count < 0) perror("epoll wait error");
     std::vector<SP_Channel> req_data = getEventsRequest(event_count);
-    if (req_data.size() > 0) return req_data;//如果等于0，则未监听到就绪事件发生，需要继续监听，不返回
+    if (req_data.size() > 0) return req_data;
+    // 没有就绪事件：是有定时器到期了就返回去处理，否则继续监听
+    if (event_count == 0 && waitTime < EPOLLWAIT_TIME) return req_data;
   }
 }
 
-void Epoll::handleExpired() { timerManager_.handleExpiredEvent(); }
-
 // 分发处理函数
 std::vector<SP_Channel> Epoll::getEventsRequest(int events_num) {
   std::vector<SP_Channel> req_data;
@@ -101,27 +97,7 @@ std::vector<SP_Channel> Epoll::getEventsRequest(int events_num) {
     // 获取有事件产生的描述符
     int fd = events_[i].data.fd;
 
-    SP_Channel cur_req = fd2chan_[fd];
-    //EventLoop* wxloop;
-    //SP_Channel cur_req = channelpool.newElement(wxloop);
-    //cur_req = fd2chan_[fd];
-    if (cur_req) {
-      cur_req->setRevents(events_[i].events);
-      cur_req->setEvents(0);
-      // 加入线程池之前将Timer和request分离
-      // cur_req->seperateTimer();
-      req_data.push_back(cur_req);
-    } else {
-      LOG << "SP cur_req is invalid";
-    }
+    fillActiveChannel(fd, events_[i].events, req_data);
   }
   return req_data;
 }
-
-void Epoll::add_timer(SP_Channel request_data, int timeout) {
-  shared_ptr<HttpData> t = request_data->getHolder();
-  if (t)
-    timerManager_.addTimer(t, timeout);
-  else
-    LOG << "timer add fail";
-}
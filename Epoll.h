@@ -7,29 +7,24 @@
 #include <vector>
 #include "Channel.h"
 #include "HttpData.h"
+#include "Poller.h"
 #include "Timer.h"
 
 
 //epoll属于一个EventLoop，一个EventLoop包含一个epoll，一个线程对应一个EventLoop，epoll并不拥有channel，epoll会监听多个文件描述符
-class Epoll {
+class Epoll : public Poller {
  public:
   Epoll();
   ~Epoll();
-  void epoll_add(SP_Channel request, int timeout);
-  void epoll_mod(SP_Channel request, int timeout);
-  void epoll_del(SP_Channel request);
+  void addChannel(SP_Channel request, int timeout);
+  void modChannel(SP_Channel request, int timeout);
+  void delChannel(SP_Channel request);
   std::vector<std::shared_ptr<Channel>> poll();// 监听就绪事件
+  const char *name() const { return "epoll"; }
   std::vector<std::shared_ptr<Channel>> getEventsRequest(int events_num);
-  void add_timer(std::shared_ptr<Channel> request_data, int timeout);
   int getEpollFd() { return epollFd_; }
-  void handleExpired();
 
  private:
-  static const int MAXFDS = 100000;
   int epollFd_;
   std::vector<epoll_event> events_;
-  std::shared_ptr<Channel> fd2chan_[MAXFDS];
-  std::shared_ptr<HttpData> fd2http_[MAXFDS];
-  TimerManager timerManager_;
-  // 每个EventLoop都有一个TimerManager，里面包含了一个时间节点的小顶堆。
 };
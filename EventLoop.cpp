@@ -4,6 +4,8 @@
 #include <sys/epoll.h>
 #include <sys/eventfd.h>
 #include <iostream>
+#include "FileCache.h"
+#include "Proxy.h"
 #include "Util.h"
 #include "base/Logging.h"
 
@@ -28,13 +30,15 @@ EFD_NONBLOCK表示对eventfd执行read/write操作时，不会阻塞。
 EventLoop::EventLoop()//创建了EventLoop对象的线程是IO线程，其主要功能是运行事件循环EventLoop::loop()
 //EventLoop对象的生命周期通常和其所属线程一样长
     : looping_(false),
-      poller_(new Epoll()),
+      poller_(Poller::newDefaultPoller()),
       wakeupFd_(createEventfd()), // 因为需要被唤醒，每个EventLoop都有一个wakeupFd_，都是新建的
       quit_(false),
       eventHandling_(false),
       callingPendingFunctors_(false),
       threadId_(CurrentThread::tid()),
-      pwakeupChannel_(new Channel(this, wakeupFd_)) {
+      pwakeupChannel_(new Channel(this, wakeupFd_)),
+      connections_(0),
+      pendingBytes_(0) {
   if (t_loopInThisThread) {//每个线程只能有一个EventLoop对象，因此EventLoop的构造函数会检查当前线程是否已经创建了其他EventLoop对象，遇到错误就终止程序
     // LOG << "Another EventLoop " << t_loopInThisThread << " exists in this
     // thread " << threadId_;
@@ -45,7 +49,7 @@ EventLoop::EventLoop()//创建了EventLoop对象的线程是IO线程，其主要
   pwakeupChannel_->setEvents(EPOLLIN | EPOLLET);//边沿触发
   pwakeupChannel_->setReadHandler(bind(&EventLoop::handleRead, this));
   pwakeupChannel_->setConnHandler(bind(&EventLoop::handleConn, this));
-  poller_->epoll_add(pwakeupChannel_, 0);
+  poller_->addChannel(pwakeupChannel_, 0);
 }
 
 void EventLoop::handleConn() {
@@ -61,6 +65,18 @@ EventLoop::~EventLoop() {
   t_loopInThisThread = NULL;
 }
 
+FileCache* EventLoop::fileCache() {
+  assertInLoopThread();
+  if (!fileCache_) fileCache_.reset(new FileCache(this));
+  return fileCache_.get();
+}
+
+UpstreamPool* EventLoop::upstreamPool() {
+  assertInLoopThread();
+  if (!upstreamPool_) upstreamPool_.reset(new UpstreamPool(this));
+  return upstreamPool_.get();
+}
+
 // EventLoop可能会在两个地方被唤醒：1、线程A调用线程B的EventLoop的runInLoop函数，线程B会被唤醒；2、线程A结束线程B的EventLoop::loop()函数，线程B会被唤醒
 void EventLoop::wakeup() {
   uint64_t one = 1;
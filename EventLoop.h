@@ -1,11 +1,12 @@
 // @Author Wang Xin
 
 #pragma once
+#include <atomic>
 #include <functional>
 #include <memory>
 #include <vector>
 #include "Channel.h"
-#include "Epoll.h"
+#include "Poller.h"
 #include "Util.h"
 #include "base/CurrentThread.h"
 #include "base/Logging.h"
@@ -15,6 +16,9 @@
 #include <iostream>
 using namespace std;
 
+class FileCache;
+class UpstreamPool;
+
 // EventLoop不仅包含epoll，还包含额外的执行函数
 class EventLoop {
  public:
@@ -36,19 +40,41 @@ class EventLoop {
   void shutdown(shared_ptr<Channel> channel) { shutDownWR(channel->getFd()); }
   void removeFromPoller(shared_ptr<Channel> channel) {
     // shutDownWR(channel->getFd());
-    poller_->epoll_del(channel);
+    poller_->delChannel(channel);
   }
   void updatePoller(shared_ptr<Channel> channel, int timeout = 0) {
-    poller_->epoll_mod(channel, timeout);
+    poller_->modChannel(channel, timeout);
   }
   void addToPoller(shared_ptr<Channel> channel, int timeout = 0) {
-    poller_->epoll_add(channel, timeout);
+    poller_->addChannel(channel, timeout);
+  }
+  // 监听socket的回调在本线程里用它代替accept
+  int acceptConn(int listenFd, struct sockaddr *addr, socklen_t *addrLen) {
+    return poller_->acceptConn(listenFd, addr, addrLen);
+  }
+  // 连接的回调在本线程里用它把响应交给poller发送，返回false时自己写socket
+  bool submitSend(int fd, OutputQueue &queue) {
+    return poller_->submitSend(fd, queue);
+  }
+  // 负载统计：连接数和还没发出去的字节数。本线程写、acceptor线程读，用relaxed原子变量，accept路径上不加锁
+  void addConnections(int n) { connections_.fetch_add(n, std::memory_order_relaxed); }
+  int connections() const { return connections_.load(std::memory_order_relaxed); }
+  void addPendingBytes(long n) { pendingBytes_.fetch_add(n, std::memory_order_relaxed); }
+  long pendingBytes() const { return pendingBytes_.load(std::memory_order_relaxed); }
+  // 本线程的静态文件缓存，第一次用到时才创建，只能在本线程中调用
+  FileCache* fileCache();
+  // 本线程到反向代理上游的连接池，第一次用到时才创建，只能在本线程中调用
+  UpstreamPool* upstreamPool();
+  // timeout毫秒后在本线程中执行cb，返回的定时器可以用clearReq()取消，只能在本线程中调用
+  std::shared_ptr<TimerNode> runAfter(int timeout, Functor&& cb) {
+    assertInLoopThread();
+    return poller_->runAfter(std::move(cb), timeout);
   }
 
  private:
   // 声明顺序 wakeupFd_ > pwakeupChannel_
   bool looping_;//是否正在运行loop
-  shared_ptr<Epoll> poller_;
+  shared_ptr<Poller> poller_;// epoll或io_uring，由Poller::setDefaultBackend决定
   int wakeupFd_;
   bool quit_;
   bool eventHandling_;//正在处理IO事件标志位
@@ -64,6 +90,10 @@ class EventLoop {
   const pid_t threadId_;//EventLoop对象的所属线程的threadID，在EventLoop对象被创建的时候，
   //threadId_被赋值为创建EventLoop对象的线程的threadID，EventLoop对象的所属线程即为创建该EventLoop对象的线程
   shared_ptr<Channel> pwakeupChannel_;//pwakeupChannel_用来处理wakeupFd_上的可读事件
+  std::atomic<int> connections_;
+  std::atomic<long> pendingBytes_;
+  std::unique_ptr<FileCache> fileCache_;
+  std::unique_ptr<UpstreamPool> upstreamPool_;
 
   // 会发送数据到wakeupfd_，所以监听wakeupfd_的EventLoop::loop->poll()函数会被唤醒
   void wakeup();
@@ -3,9 +3,10 @@
 #include "EventLoopThread.h"
 #include <functional>
 
-EventLoopThread::EventLoopThread()
+EventLoopThread::EventLoopThread(int cpu)
     : loop_(NULL),
       exiting_(false),
+      cpu_(cpu),
       thread_(bind(&EventLoopThread::threadFunc, this), "EventLoopThread"),
       mutex_(),
       cond_(mutex_) {}
@@ -30,6 +31,8 @@ EventLoop* EventLoopThread::startLoop() {
 }
 
 void EventLoopThread::threadFunc() {
+  // 先绑核再构造EventLoop，Epoll的events_、fd2chan_等都在本线程中首次写入，会分配在本核所在的NUMA节点上
+  CurrentThread::bindToCpu(cpu_);
   EventLoop loop;//线程运行一个loop，虽然现在这个loop里什么都没有
 
   {
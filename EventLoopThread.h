@@ -11,7 +11,7 @@
 // 包含EventLoop和EventLoop的所属线程的信息
 class EventLoopThread : noncopyable {
  public:
-  EventLoopThread();
+  explicit EventLoopThread(int cpu = -1);
   ~EventLoopThread();
   EventLoop* startLoop();
 
@@ -19,6 +19,7 @@ class EventLoopThread : noncopyable {
   void threadFunc();
   EventLoop* loop_;
   bool exiting_;
+  int cpu_;// 绑定的CPU核，-1表示由调度器决定
   Thread thread_;
   MutexLock mutex_;//对EventLoopThread的loop_操作，需要先加锁
   Condition cond_;
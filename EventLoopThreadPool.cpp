@@ -3,7 +3,12 @@
 #include "EventLoopThreadPool.h"
 
 EventLoopThreadPool::EventLoopThreadPool(EventLoop *baseLoop, int numThreads)
-    : baseLoop_(baseLoop), started_(false), numThreads_(numThreads), next_(0) {
+    : baseLoop_(baseLoop),
+      started_(false),
+      numThreads_(numThreads),
+      next_(0),
+      policy_(LB_ROUND_ROBIN),
+      seed_(2463534242u) {
   if (numThreads_ <= 0) {
     LOG << "numThreads_ <= 0";
     abort();//终止当前进程
@@ -14,7 +19,8 @@ void EventLoopThreadPool::start() {
   baseLoop_->assertInLoopThread();// baseLoop_是在创建服务器时被创建的，使用baseLoop_的线程应和创建baseLoop_的线程一致
   started_ = true;
   for (int i = 0; i < numThreads_; ++i) {
-    std::shared_ptr<EventLoopThread> t(new EventLoopThread());
+    int cpu = cpus_.empty() ? -1 : cpus_[i % cpus_.size()];
+    std::shared_ptr<EventLoopThread> t(new EventLoopThread(cpu));
     threads_.push_back(t);
     loops_.push_back(t->startLoop());
     /* 会运行各个EventLoopThread对应的thread，并且存放各个EventLoopThread的EventLoop， 这些EventLoop虽然什么都没有，但是已经运行起来了，即已经调用EventLoop::loop()函数了
@@ -27,9 +33,47 @@ EventLoop *EventLoopThreadPool::getNextLoop() {
   baseLoop_->assertInLoopThread();
   assert(started_);
   EventLoop *loop = baseLoop_;// 如果loops_为空，则用baseloop_
-  if (!loops_.empty()) {
-    loop = loops_[next_];
-    next_ = (next_ + 1) % numThreads_;
+  if (loops_.empty()) return loop;
+  switch (policy_) {
+    case LB_LEAST_CONNECTIONS:
+      return leastLoaded();
+    case LB_POWER_OF_TWO:
+      return powerOfTwo();
+    default:
+      loop = loops_[next_];
+      next_ = (next_ + 1) % numThreads_;
   }
   return loop;
 }
+
+// 每64KB还没发出去的数据按一个连接计算，一个在慢慢下载大文件的EventLoop不会被当成空闲的
+long EventLoopThreadPool::loadOf(EventLoop *loop) {
+  return loop->connections() + (loop->pendingBytes() >> 16);
+}
+
+EventLoop *EventLoopThreadPool::leastLoaded() {
+  // 从next_开始扫描，负载相同时轮流选择，避免新连接全部压到loops_[0]上
+  EventLoop *best = loops_[next_];
+  long bestLoad = loadOf(best);
+  for (int i = 1; i < numThreads_ && bestLoad > 0; ++i) {
+    EventLoop *loop = loops_[(next_ + i) % numThreads_];
+    long load = loadOf(loop);
+    if (load < bestLoad) {
+      best = loop;
+      bestLoad = load;
+    }
+  }
+  next_ = (next_ + 1) % numThreads_;
+  return best;
+}
+
+EventLoop *EventLoopThreadPool::powerOfTwo() {
+  if (numThreads_ == 1) return loops_[0];
+  // xorshift32，足够打散选择，又不用加锁
+  seed_ ^= seed_ << 13;
+  seed_ ^= seed_ >> 17;
+  seed_ ^= seed_ << 5;
+  int a = seed_ % numThreads_;
+  int b = (a + 1 + (seed_ >> 16) % (numThreads_ - 1)) % numThreads_;
+  return loadOf(loops_[b]) < loadOf(loops_[a]) ? loops_[b] : loops_[a];
+}
@@ -7,6 +7,12 @@
 #include "base/Logging.h"
 #include "base/noncopyable.h"
 
+// getNextLoop选择EventLoop的策略
+enum LoadBalancePolicy {
+  LB_ROUND_ROBIN = 0,
+  LB_LEAST_CONNECTIONS,// 选负载最小的EventLoop
+  LB_POWER_OF_TWO// 随机取两个EventLoop，选负载较小的那个
+};
 
 class EventLoopThreadPool : noncopyable {
  public:
@@ -14,18 +20,29 @@ class EventLoopThreadPool : noncopyable {
 
   ~EventLoopThreadPool() { LOG << "~EventLoopThreadPool()"; }
   void start();
+  void setPolicy(LoadBalancePolicy policy) { policy_ = policy; }
+  // 第i个EventLoopThread绑定到cpus[i % cpus.size()]，必须在start()之前调用
+  void setCpus(const std::vector<int>& cpus) { cpus_ = cpus; }
 
   EventLoop* getNextLoop();
   /*
   在Server::handNewConn()中，getNextLoop函数被用来获取下一个EventLoop,
   依次将从server::listenfd_上监听到的连接请求分发给各个EventLoop
   */
+  std::vector<EventLoop*> getAllLoops() const { return loops_; }// SO_REUSEPORT模式下，Server要在每个EventLoop上各建一个监听socket
 
  private:
   EventLoop* baseLoop_;// baseLoop_是在创建服务器时被创建的，这是服务器的主循环，用来将到达的连接请求分配给loops_中的某一个EventLoop
   bool started_;
   int numThreads_;
   int next_;
+  LoadBalancePolicy policy_;
+  unsigned int seed_;// LB_POWER_OF_TWO的随机数状态，只有baseLoop_线程访问
   std::vector<std::shared_ptr<EventLoopThread>> threads_;//存放numThreads_个EventLoopThread
   std::vector<EventLoop*> loops_;//存放numThreads_个EventLoopThread的EventLoop
+  std::vector<int> cpus_;
+
+  static long loadOf(EventLoop* loop);
+  EventLoop* leastLoaded();
+  EventLoop* powerOfTwo();
 };
@@ -0,0 +1,181 @@
+// @Author Wang Xin
+
+#include "FileCache.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <time.h>
+#include <unistd.h>
+#include "Channel.h"
+#include "EventLoop.h"
+#include "base/Logging.h"
+
+size_t FileCache::defaultMaxEntries_ = 4096;
+int FileCache::defaultTtlMs_ = 5000;
+bool FileCache::defaultInotify_ = false;
+
+// CLOCK_MONOTONIC_COARSE走vDSO，不陷入内核，精度是一个tick，用来判断TTL足够了
+static long nowMs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+  return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+static bool sameFile(const struct stat &a, const struct stat &b) {
+  return a.st_ino == b.st_ino && a.st_dev == b.st_dev &&
+         a.st_size == b.st_size && a.st_mtim.tv_sec == b.st_mtim.tv_sec &&
+         a.st_mtim.tv_nsec == b.st_mtim.tv_nsec;
+}
+
+void FileCache::setOptions(size_t maxEntries, int ttlMs, bool useInotify) {
+  defaultMaxEntries_ = maxEntries;
+  defaultTtlMs_ = ttlMs;
+  defaultInotify_ = useInotify;
+}
+
+FileCache::FileCache(EventLoop *loop)
+    : loop_(loop),
+      maxEntries_(defaultMaxEntries_),
+      ttlMs_(defaultTtlMs_),
+      hits_(0),
+      misses_(0),
+      inotifyFd_(-1) {
+  if (defaultInotify_ && maxEntries_ > 0) {
+    inotifyFd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFd_ < 0) {
+      LOG << "inotify_init1 failed, file cache falls back to TTL only";
+    } else {
+      // Channel析构时会关闭inotifyFd_
+      inotifyChannel_.reset(new Channel(loop_, inotifyFd_));
+      inotifyChannel_->setEvents(EPOLLIN | EPOLLET);
+      inotifyChannel_->setReadHandler(bind(&FileCache::handleInotify, this));
+      inotifyChannel_->setConnHandler(
+          bind(&FileCache::handleInotifyConn, this));
+      loop_->addToPoller(inotifyChannel_, 0);
+    }
+  }
+}
+
+FileCache::~FileCache() {
+  if (inotifyChannel_) loop_->removeFromPoller(inotifyChannel_);
+}
+
+FileCache::EntryPtr FileCache::statFile(const std::string &path, long now) {
+  EntryPtr entry(new Entry);
+  entry->path = path;
+  entry->exists =
+      ::stat(path.c_str(), &entry->st) == 0 && S_ISREG(entry->st.st_mode);
+  entry->expireAt = now + ttlMs_;
+  return entry;
+}
+
+FileCache::EntryPtr FileCache::lookup(const std::string &path) {
+  long now = nowMs();
+  std::unordered_map<std::string, LruList::iterator>::iterator it =
+      map_.find(path);
+  if (it == map_.end()) {
+    ++misses_;
+    EntryPtr entry = statFile(path, now);
+    insert(entry);
+    return entry;
+  }
+  lru_.splice(lru_.begin(), lru_, it->second);
+  EntryPtr entry = *it->second;
+  if (now < entry->expireAt) {
+    ++hits_;
+    return entry;
+  }
+  // 过期了，重新stat一次；文件没变的话保留已经打开的fd
+  ++misses_;
+  EntryPtr fresh = statFile(path, now);
+  if (fresh->exists && entry->exists && sameFile(fresh->st, entry->st))
+    fresh->file = entry->file;
+  *it->second = fresh;
+  return fresh;
+}
+
+void FileCache::insert(const EntryPtr &entry) {
+  if (maxEntries_ == 0) return;
+  while (map_.size() >= maxEntries_) {
+    map_.erase(lru_.back()->path);
+    lru_.pop_back();
+  }
+  lru_.push_front(entry);
+  map_[entry->path] = lru_.begin();
+  if (inotifyFd_ >= 0) watchDir(entry->path);
+}
+
+std::shared_ptr<FileHandle> FileCache::open(const EntryPtr &entry) {
+  if (!entry->exists) return std::shared_ptr<FileHandle>();
+  if (!entry->file) {
+    int fd = ::open(entry->path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return std::shared_ptr<FileHandle>();
+    // 正在发送的响应持有FileHandle的引用，条目被淘汰或失效后fd要等它们发完才关闭
+    entry->file = std::make_shared<FileHandle>(fd);
+  }
+  return entry->file;
+}
+
+void FileCache::invalidate(const std::string &path) {
+  std::unordered_map<std::string, LruList::iterator>::iterator it =
+      map_.find(path);
+  if (it == map_.end()) return;
+  lru_.erase(it->second);
+  map_.erase(it);
+}
+
+// 监听文件所在的目录而不是文件本身：这样文件被删除、重新创建或者被rename覆盖时也能收到通知
+void FileCache::watchDir(const std::string &path) {
+  size_t slash = path.rfind('/');
+  std::string dir = slash == std::string::npos ? "." : path.substr(0, slash);
+  if (dir.empty()) dir = "/";
+  if (dir2wd_.count(dir)) return;
+  int wd = inotify_add_watch(inotifyFd_, dir.c_str(),
+                             IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE |
+                                 IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF |
+                                 IN_MOVE_SELF);
+  // 目录本身不存在时监听不了，这类负缓存条目只靠TTL过期
+  if (wd < 0) return;
+  dir2wd_[dir] = wd;
+  wd2dir_[wd] = dir;
+}
+
+void FileCache::handleInotify() {
+  char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  while (true) {
+    ssize_t n = read(inotifyFd_, buf, sizeof buf);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) break;
+    for (char *p = buf; p < buf + n;) {
+      const struct inotify_event *event =
+          reinterpret_cast<const struct inotify_event *>(p);
+      p += sizeof(struct inotify_event) + event->len;
+      if (event->mask & IN_Q_OVERFLOW) {
+        // 丢了事件，不知道哪些文件变了，只能全部作废
+        lru_.clear();
+        map_.clear();
+        continue;
+      }
+      std::unordered_map<int, std::string>::iterator it =
+          wd2dir_.find(event->wd);
+      if (it == wd2dir_.end()) continue;
+      if (event->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) {
+        // 目录本身没了，它下面的条目数不多，直接全部作废比逐个找前缀简单
+        lru_.clear();
+        map_.clear();
+        if (event->mask & IN_IGNORED) {
+          dir2wd_.erase(it->second);
+          wd2dir_.erase(it);
+        }
+        continue;
+      }
+      if (event->len == 0) continue;
+      const std::string &dir = it->second;
+      invalidate(dir == "." ? std::string(event->name)
+                            : dir + "/" + event->name);
+    }
+  }
+  inotifyChannel_->setEvents(EPOLLIN | EPOLLET);
+}
+
+void FileCache::handleInotifyConn() { loop_->updatePoller(inotifyChannel_, 0); }
@@ -0,0 +1,74 @@
+// @Author Wang Xin
+
+#pragma once
+#include <sys/stat.h>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include "OutputQueue.h"
+#include "base/noncopyable.h"
+
+class EventLoop;
+class Channel;
+
+/*
+每个EventLoop一份的静态文件缓存，只在所属线程中访问，不加锁：
+  记下stat的结果(不存在的文件也记，作为负缓存直接回404)，第一次真正要发送文件内容时才open，
+  之后同一个文件的请求共用这个fd，命中时不做任何文件系统调用
+条目数有上限，超出时按LRU淘汰；过了TTL后重新stat校验一次，文件没变就继续用原来的fd。
+打开inotify时监听缓存文件所在的目录，文件被修改、删除、改名后立即失效，不用等到TTL
+*/
+class FileCache : noncopyable {
+ public:
+  struct Entry {
+    std::string path;
+    bool exists;// 为false时是负缓存：文件不存在或者不是普通文件
+    struct stat st;
+    std::shared_ptr<FileHandle> file;// 还没打开时为空
+    long expireAt;// 毫秒，单调时钟
+  };
+  typedef std::shared_ptr<Entry> EntryPtr;
+
+  explicit FileCache(EventLoop *loop);
+  ~FileCache();
+
+  // 返回path的stat结果，exists为false表示文件不存在
+  EntryPtr lookup(const std::string &path);
+  // 返回打开的文件，打不开返回空指针
+  std::shared_ptr<FileHandle> open(const EntryPtr &entry);
+  void invalidate(const std::string &path);
+
+  size_t size() const { return map_.size(); }
+  long hits() const { return hits_; }
+  long misses() const { return misses_; }
+
+  // 对之后创建的FileCache生效，必须在EventLoop线程启动之前调用。maxEntries为0时不缓存
+  static void setOptions(size_t maxEntries, int ttlMs, bool useInotify);
+
+ private:
+  typedef std::list<EntryPtr> LruList;
+
+  EventLoop *loop_;
+  size_t maxEntries_;
+  int ttlMs_;
+  LruList lru_;// 表头是最近用过的
+  std::unordered_map<std::string, LruList::iterator> map_;
+  long hits_;
+  long misses_;
+
+  int inotifyFd_;
+  std::shared_ptr<Channel> inotifyChannel_;
+  std::unordered_map<int, std::string> wd2dir_;
+  std::unordered_map<std::string, int> dir2wd_;
+
+  static size_t defaultMaxEntries_;
+  static int defaultTtlMs_;
+  static bool defaultInotify_;
+
+  EntryPtr statFile(const std::string &path, long now);
+  void insert(const EntryPtr &entry);
+  void watchDir(const std::string &path);
+  void handleInotify();
+  void handleInotifyConn();
+};
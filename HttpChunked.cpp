@@ -0,0 +1,159 @@
+// @Author Wang Xin
+
+#include "HttpChunked.h"
+#include <algorithm>
+
+const char ChunkedEncoder::kChunkEnd[3] = "\r\n";
+const char ChunkedEncoder::kLastChunk[6] = "0\r\n\r\n";
+
+namespace {
+
+inline int hexValue(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+// 扩展和trailer里允许HTAB和可见字符，不允许别的控制字符
+inline bool isFieldChar(char c) {
+  unsigned char u = static_cast<unsigned char>(c);
+  return u == '\t' || (u >= 0x20 && u != 0x7f);
+}
+
+}  // namespace
+
+void ChunkedDecoder::reset() {
+  state_ = SIZE_START;
+  chunkSize_ = 0;
+  digits_ = 0;
+  extLen_ = 0;
+  trailerLen_ = 0;
+  bodyBytes_ = 0;
+}
+
+size_t ChunkedDecoder::decode(const char *data, size_t len, StringPiece *piece) {
+  piece->clear();
+  size_t i = 0;
+  while (i < len && state_ != DONE && state_ != ERROR) {
+    char c = data[i];
+    switch (state_) {
+      case SIZE_START:
+      case SIZE: {
+        int v = hexValue(c);
+        if (v >= 0) {
+          if (++digits_ > kMaxSizeDigits) {
+            state_ = ERROR;
+            break;
+          }
+          chunkSize_ = chunkSize_ * 16 + v;
+          state_ = SIZE;
+        } else if (state_ == SIZE_START) {
+          state_ = ERROR;
+          break;
+        } else if (c == '\r') {
+          state_ = SIZE_LF;
+        } else if (c == ';' || c == ' ' || c == '\t') {
+          // 长度后面可以有空白(BWS)再跟扩展
+          state_ = EXT;
+        } else {
+          state_ = ERROR;
+          break;
+        }
+        ++i;
+        break;
+      }
+      case EXT:
+        if (c == '\r')
+          state_ = SIZE_LF;
+        else if (!isFieldChar(c) || ++extLen_ > kMaxExtension) {
+          state_ = ERROR;
+          break;
+        }
+        ++i;
+        break;
+      case SIZE_LF:
+        if (c != '\n') {
+          state_ = ERROR;
+          break;
+        }
+        state_ = chunkSize_ == 0 ? TRAILER_START : DATA;
+        ++i;
+        break;
+      case DATA: {
+        size_t n = std::min(len - i, chunkSize_);
+        piece->set(data + i, n);
+        i += n;
+        chunkSize_ -= n;
+        bodyBytes_ += n;
+        if (chunkSize_ == 0) state_ = DATA_CR;
+        // 一次只返回一段数据
+        return i;
+      }
+      case DATA_CR:
+        if (c != '\r') {
+          state_ = ERROR;
+          break;
+        }
+        state_ = DATA_LF;
+        ++i;
+        break;
+      case DATA_LF:
+        if (c != '\n') {
+          state_ = ERROR;
+          break;
+        }
+        state_ = SIZE_START;
+        digits_ = 0;
+        extLen_ = 0;
+        ++i;
+        break;
+      case TRAILER_START:
+      case TRAILER:
+        if (c == '\r') {
+          state_ = state_ == TRAILER_START ? END_LF : TRAILER_LF;
+        } else if (!isFieldChar(c) || ++trailerLen_ > kMaxTrailer) {
+          state_ = ERROR;
+          break;
+        } else {
+          state_ = TRAILER;
+        }
+        ++i;
+        break;
+      case TRAILER_LF:
+      case END_LF:
+        if (c != '\n') {
+          state_ = ERROR;
+          break;
+        }
+        state_ = state_ == END_LF ? DONE : TRAILER_START;
+        ++i;
+        break;
+      default:
+        break;
+    }
+  }
+  return i;
+}
+
+size_t ChunkedDecoder::scan(const char *data, size_t len) {
+  size_t used = 0;
+  StringPiece piece;
+  while (used < len && !done() && !error())
+    used += decode(data + used, len - used, &piece);
+  return used;
+}
+
+size_t ChunkedEncoder::formatHeader(size_t len, char *buf) {
+  static const char kDigits[] = "0123456789abcdef";
+  char tmp[2 * sizeof(size_t)];
+  size_t n = 0;
+  do {
+    tmp[n++] = kDigits[len & 0xf];
+    len >>= 4;
+  } while (len != 0);
+  for (size_t i = 0; i < n; ++i) buf[i] = tmp[n - 1 - i];
+  buf[n] = '\r';
+  buf[n + 1] = '\n';
+  return n + 2;
+}
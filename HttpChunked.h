@@ -0,0 +1,69 @@
+// @Author Wang Xin
+
+#pragma once
+#include <stddef.h>
+#include "base/StringPiece.h"
+
+/*
+chunked编码(RFC 9112 7.1)的流式解码器，按字节推进状态，数据不需要一次收全：
+  chunk-size [ chunk-ext ] CRLF chunk-data CRLF ... 0 CRLF [ trailer-field CRLF ]* CRLF
+块数据不拷贝，decode直接返回它在输入里的位置，由调用者交给处理请求体的代码或者原样转发。
+块头、扩展和trailer按长度设了上限，一个连接为解码占用的内存和请求体的大小无关
+*/
+class ChunkedDecoder {
+ public:
+  ChunkedDecoder() { reset(); }
+
+  void reset();
+  // 解码[data, data + len)，返回用掉的字节数。遇到块数据时停在这段数据的末尾，*piece指向它；
+  // 这一次没有块数据时piece为空。消息结束或者出错后不再继续用掉输入
+  size_t decode(const char *data, size_t len, StringPiece *piece);
+  // 只找出消息在哪结束，返回属于这个消息的字节数(数据原样转发时用)
+  size_t scan(const char *data, size_t len);
+
+  bool done() const { return state_ == DONE; }
+  bool error() const { return state_ == ERROR; }
+  // 到目前为止解出来的块数据的总字节数
+  size_t bodyBytes() const { return bodyBytes_; }
+
+  // 十六进制长度最多这么多位，再长就可能溢出
+  static const int kMaxSizeDigits = 15;
+  static const size_t kMaxExtension = 1024;
+  static const size_t kMaxTrailer = 8192;
+
+ private:
+  enum State {
+    SIZE_START = 0,// 块头的第一个字符，必须是十六进制数字
+    SIZE,
+    EXT,// ';'之后的扩展，忽略内容
+    SIZE_LF,
+    DATA,
+    DATA_CR,
+    DATA_LF,
+    TRAILER_START,// 一行trailer的开头，是CR时消息结束
+    TRAILER,
+    TRAILER_LF,
+    END_LF,
+    DONE,
+    ERROR
+  };
+
+  State state_;
+  size_t chunkSize_;// SIZE时是已经读到的长度，DATA时是这一块还剩的字节数
+  int digits_;
+  size_t extLen_;
+  size_t trailerLen_;
+  size_t bodyBytes_;
+};
+
+// chunked编码：块头"<十六进制长度>\r\n"，返回写进buf的字节数
+class ChunkedEncoder {
+ public:
+  // buf至少要有这么大
+  static const size_t kMaxHeader = 2 * sizeof(size_t) + 2;
+  static size_t formatHeader(size_t len, char *buf);
+  // 一块数据后面的CRLF
+  static const char kChunkEnd[3];
+  // 最后一块(长度为0)和结束的空行，不带trailer
+  static const char kLastChunk[6];
+};
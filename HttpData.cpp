@@ -1,12 +1,18 @@
 // @Author Wang Xin
 
 #include "HttpData.h"
+#include <errno.h>
 #include <fcntl.h>
-#include <sys/mman.h>
+#include <string.h>
+#include <strings.h>
 #include <sys/stat.h>
+#include <algorithm>
 #include <iostream>
 #include "Channel.h"
+#include "ContentCache.h"
+#include "FileCache.h"
 #include "EventLoop.h"
+#include "Proxy.h"
 #include "Util.h"
 #include "time.h"
 
@@ -14,10 +20,14 @@ using namespace std;
 
 pthread_once_t MimeType::once_control = PTHREAD_ONCE_INIT;
 std::unordered_map<std::string, std::string> MimeType::mime;
+int HttpData::maxPipelined_ = 16;
+size_t HttpData::bodyHighWater_ = 1024 * 1024;
 
 const __uint32_t DEFAULT_EVENT = EPOLLIN | EPOLLET | EPOLLONESHOT;
 const int DEFAULT_EXPIRED_TIME = 2000;              // ms
 const int DEFAULT_KEEP_ALIVE_TIME = 5 * 60 * 1000;  // ms
+const int ZEROCOPY_LINGER_TIME = 10 * 1000;         // ms
+const int MAX_HEADER_LINE = 8192;                   // 一行头部的最大字节数
 
 char favicon[555] = {
     '\x89', 'P',    'N',    'G',    '\xD',  '\xA',  '\x1A', '\xA',  '\x0',
@@ -98,9 +108,21 @@ void MimeType::init() {
   mime[".png"] = "image/png";
   mime[".txt"] = "text/plain";
   mime[".mp3"] = "audio/mp3";
+  mime[".css"] = "text/css";
+  mime[".js"] = "application/javascript";
+  mime[".json"] = "application/json";
+  mime[".xml"] = "application/xml";
+  mime[".svg"] = "image/svg+xml";
   mime["default"] = "text/html";
 }
 
+// 文本类的内容压缩率高，值得gzip；图片、音视频和.gz本身已经压缩过了
+bool MimeType::isCompressible(const std::string &type) {
+  return type.compare(0, 5, "text/") == 0 ||
+         type == "application/javascript" || type == "application/json" ||
+         type == "application/xml" || type == "image/svg+xml";
+}
+
 std::string MimeType::getMime(const std::string &suffix) {
   pthread_once(&once_control, MimeType::init);
   if (mime.find(suffix) == mime.end())
@@ -109,29 +131,78 @@ std::string MimeType::getMime(const std::string &suffix) {
     return mime[suffix];
 }
 
-HttpData::HttpData(EventLoop *loop, int connfd)
+HttpData::HttpData(EventLoop *loop, int connfd, bool tls)
     : loop_(loop),
       channel_(new Channel(loop, connfd)),
       fd_(connfd),
+      tls_(tls ? new TlsConn(connfd) : NULL),
       error_(false),
       connectionState_(H_CONNECTED),
       method_(METHOD_GET),
       HTTPVersion_(HTTP_11),
+      lineResult_(REQUEST_LINE_OK),
       nowReadPos_(0),
       state_(STATE_PARSE_URI),
       hState_(H_START),
-      keepAlive_(false) {
+      keepAlive_(false),
+      reportedPending_(0),
+      bodyRemain_(0),
+      bodyChunked_(false),
+      chunkedResponse_(false),
+      responseStarted_(false),
+      bodyPaused_(false),
+      readScheduled_(false),
+      pipelineBlocked_(false),
+      pipelineScheduled_(false),
+      recvByPoller_(false),
+      received_(0),
+      peerClosed_(false),
+      receiveError_(false),
+      sendInFlight_(false),
+      sendError_(0) {
+  loop_->addConnections(1);
   // loop_->queueInLoop(bind(&HttpData::setHandlers, this));
   channel_->setReadHandler(bind(&HttpData::handleRead, this));
-  channel_->setWriteHandler(bind(&HttpData::handleWrite, this));
+  channel_->setWriteHandler(bind(&HttpData::handleWritable, this));
   channel_->setConnHandler(bind(&HttpData::handleConn, this));
+  channel_->setErrorHandler(bind(&HttpData::handleErrorEvent, this));
+}
+
+// 什么也不做，只是让绑定的缓冲区活到定时器到期
+static void releaseZeroCopyBuffers(const OutputQueue::PinnedBuffers &) {}
+
+HttpData::~HttpData() {
+  if (upstream_) upstream_->abort();
+  // 关闭连接不会撤回已经交给内核的零拷贝数据，收不到完成通知了，缓冲区再保留一段时间才释放
+  if (outQueue_.zeroCopyPending())
+    loop_->runAfter(ZEROCOPY_LINGER_TIME,
+                    bind(&releaseZeroCopyBuffers, outQueue_.takeZeroCopyPinned()));
+  loop_->addPendingBytes(-reportedPending_);
+  loop_->addConnections(-1);
+}
+
+// 把outQueue_的变化量同步到所属EventLoop的负载统计中
+void HttpData::updatePendingBytes() {
+  long pending = static_cast<long>(outQueue_.readableBytes());
+  if (pending != reportedPending_) {
+    loop_->addPendingBytes(pending - reportedPending_);
+    reportedPending_ = pending;
+  }
 }
 
 void HttpData::reset() {
   // inBuffer_.clear();
   fileName_.clear();
+  uri_.clear();
+  query_.clear();
   path_.clear();
   nowReadPos_ = 0;
+  bodyRemain_ = 0;
+  bodyChunked_ = false;
+  chunked_.reset();
+  bodySink_.reset();
+  chunkedResponse_ = false;
+  responseStarted_ = false;
   state_ = STATE_PARSE_URI;
   hState_ = H_START;
   headers_.clear();
@@ -152,14 +223,192 @@ void HttpData::seperateTimer() {
   }
 }
 
+// 推进TLS握手，握手完成返回true；没完成时按OpenSSL的需要等可读或者可写
+bool HttpData::tlsHandshake() {
+  __uint32_t &events_ = channel_->getEvents();
+  switch (tls_->handshake()) {
+    case TlsConn::TLS_OK:
+      return true;
+    case TlsConn::TLS_WANT_READ:
+      events_ |= EPOLLIN;
+      return false;
+    case TlsConn::TLS_WANT_WRITE:
+      events_ |= EPOLLOUT;
+      return false;
+    default:
+      error_ = true;
+      return false;
+  }
+}
+
+// 按Transfer-Encoding和Content-Length确定请求体的边界，不合法时回错误页并返回false
+bool HttpData::prepareBody() {
+  switch (headers_.bodyFraming(&bodyRemain_)) {
+    case FRAMING_UNSUPPORTED:
+      handleError(fd_, 501, "Not Implemented");
+      return false;
+    case FRAMING_INVALID:
+      handleError(fd_, 400, "Bad Request");
+      return false;
+    case FRAMING_CHUNKED:
+      if (HTTPVersion_ == HTTP_10) {
+        handleError(fd_, 400, "Bad Request");
+        return false;
+      }
+      bodyChunked_ = true;
+      break;
+    default:
+      break;
+  }
+  return true;
+}
+
+// 把inBuffer_里已经收到的请求体交给bodySink_并从inBuffer_里拿掉，chunked的块头等在这里去掉。
+// 出错时*status是要回的状态码
+BodyState HttpData::consumeBody(int *status) {
+  while (bodyPending() && inBuffer_.readableBytes() > 0) {
+    StringPiece piece;
+    size_t n;
+    if (bodyChunked_) {
+      n = chunked_.decode(inBuffer_.peek(), inBuffer_.readableBytes(), &piece);
+      if (chunked_.error()) {
+        LOG << "FD = " << fd_ << ", bad chunked body after "
+            << chunked_.bodyBytes() << " bytes";
+        *status = 400;
+        return BODY_ERROR;
+      }
+    } else {
+      n = std::min(bodyRemain_, inBuffer_.readableBytes());
+      piece.set(inBuffer_.peek(), n);
+      bodyRemain_ -= n;
+    }
+    // 没有处理程序要的请求体直接丢掉
+    if (!piece.empty() && bodySink_) {
+      *status = bodySink_->onData(piece.data(), piece.size());
+      if (*status != 0) return BODY_ERROR;
+    }
+    inBuffer_.retrieve(n);
+  }
+  return bodyPending() ? BODY_AGAIN : BODY_DONE;
+}
+
+// BodySink拒绝请求体时给出的状态码对应的原因短语
+static const char *bodyErrorReason(int status) {
+  switch (status) {
+    case 400:
+      return "Bad Request";
+    case 403:
+      return "Forbidden";
+    case 411:
+      return "Length Required";
+    case 413:
+      return "Payload Too Large";
+    case 415:
+      return "Unsupported Media Type";
+    default:
+      return "Internal Server Error";
+  }
+}
+
+void HttpData::beginChunkedResponse(string header) {
+  // HTTP/1.0的客户端不认识chunked，数据原样发出，以关闭连接作为结束
+  chunkedResponse_ = HTTPVersion_ == HTTP_11;
+  if (chunkedResponse_) {
+    header += "Transfer-Encoding: chunked\r\n";
+    if (keepAlive_) {
+      header += string("Connection: Keep-Alive\r\n") + "Keep-Alive: timeout=" +
+                to_string(DEFAULT_KEEP_ALIVE_TIME) + "\r\n";
+    }
+  } else {
+    keepAlive_ = false;
+    header += "Connection: Close\r\n";
+  }
+  header += "Server: WangXin's Web Server\r\n\r\n";
+  outQueue_.append(header);
+  responseStarted_ = true;
+}
+
+void HttpData::appendChunk(const char *data, size_t len) {
+  // 长度为0的块表示响应结束，不能用来发空数据
+  if (len == 0) return;
+  if (chunkedResponse_) {
+    char head[ChunkedEncoder::kMaxHeader];
+    outQueue_.append(head, ChunkedEncoder::formatHeader(len, head));
+  }
+  outQueue_.append(data, len);
+  if (chunkedResponse_) outQueue_.append(ChunkedEncoder::kChunkEnd,
+                                        sizeof ChunkedEncoder::kChunkEnd - 1);
+}
+
+void HttpData::endChunkedResponse() {
+  if (chunkedResponse_) {
+    outQueue_.append(ChunkedEncoder::kLastChunk,
+                     sizeof ChunkedEncoder::kLastChunk - 1);
+  } else {
+    // 后面的请求没法再回了，发完就关闭
+    connectionState_ = H_DISCONNECTING;
+    inBuffer_.retrieveAll();
+  }
+  chunkedResponse_ = false;
+}
+
+// 长度已知的完整响应，body不大，由BodySink在请求体收完后调用
+void HttpData::appendResponse(const string &status, const string &contentType,
+                              const string &body) {
+  string header = "HTTP/1.1 " + status + "\r\n";
+  if (keepAlive_) {
+    header += string("Connection: Keep-Alive\r\n") + "Keep-Alive: timeout=" +
+              to_string(DEFAULT_KEEP_ALIVE_TIME) + "\r\n";
+  }
+  header += "Content-Type: " + contentType + "\r\n";
+  header += "Content-Length: " + to_string(body.size()) + "\r\n";
+  header += "Server: WangXin's Web Server\r\n\r\n";
+  outQueue_.append(header);
+  outQueue_.append(body);
+  responseStarted_ = true;
+}
+
 void HttpData::handleRead() {
   __uint32_t &events_ = channel_->getEvents();
+  if (tls_ && !tls_->established() && !tlsHandshake()) return;
+  bool more = false;
+  int rounds = 0;
   do {
+    // 上游来不及收请求体时先不读，等发出去一些再由resumeProxyBody接着读
+    if (state_ == STATE_PROXY && upstream_ && upstream_->writeBlocked()) break;
+    // 处理请求体产生的输出来不及发给客户端时也先不读，发出去一半后由handleWritable接着读
+    if (state_ == STATE_RECV_BODY && outQueue_.readableBytes() >= bodyHighWater_) {
+      handleWrite();
+      if (error_) break;
+      if (outQueue_.readableBytes() >= bodyHighWater_) {
+        bodyPaused_ = true;
+        break;
+      }
+    }
+    // 读了kBodyReadRounds轮还没读完，剩下的放到这一轮事件处理之后，不让一个上传占住事件循环
+    if (more && ++rounds >= kBodyReadRounds) {
+      scheduleRead();
+      break;
+    }
+    // 收请求体和往上游转发请求体时每次只读kBodyReadChunk字节，交出去以后再读，inBuffer_不会被大的请求体撑大
+    size_t limit =
+        state_ == STATE_RECV_BODY || state_ == STATE_PROXY ? kBodyReadChunk : 0;
     bool zero = false;
-    int read_num = readn(fd_, inBuffer_, zero);
-    LOG << "Request: " << inBuffer_;
+    int read_num;
+    if (recvByPoller_) {
+      // 数据已经由IoUringPoller放进inBuffer_了，每次只有一个缓冲区，不用分轮读
+      read_num = receiveError_ ? -1 : static_cast<int>(received_);
+      received_ = 0;
+      zero = peerClosed_;
+    } else {
+      read_num = tls_ ? tls_->read(inBuffer_, zero, limit)
+                      : readn(fd_, inBuffer_, zero, limit);
+      more = limit > 0 && !zero && read_num >= static_cast<int>(limit);
+    }
+    if (limit == 0)
+      (LOG << "Request: ").append(inBuffer_.peek(), inBuffer_.readableBytes());
     if (connectionState_ == H_DISCONNECTING) {
-      inBuffer_.clear();
+      inBuffer_.retrieveAll();
       break;
     }
     // cout << inBuffer_ << endl;
@@ -188,16 +437,74 @@ void HttpData::handleRead() {
       // cout << "readnum == 0" << endl;
     }
 
+    if (state_ == STATE_PROXY) {
+      forwardProxyBody();
+      // 上游堵住时由resumeProxyBody接着读，否则和收请求体一样放到这一轮事件处理之后
+      if (more && upstream_ && !upstream_->writeBlocked()) scheduleRead();
+      break;
+    }
+    processRequests();
+  } while (more && !error_);
+  // cout << "state_=" << state_ << endl;
+  if (!error_) {
+    // 这一批请求的响应一起发出去，连续的内存段合成一次sendmsg
+    if (!outQueue_.empty()) handleWrite();
+    // error_ may change
+    if (!error_ && connectionState_ != H_DISCONNECTED && !bodyPaused_)
+      events_ |= EPOLLIN;
+    continuePipeline();
+  }
+}
+
+bool HttpData::receiveByPoller() {
+  if (tls_) return false;
+  recvByPoller_ = true;
+  return true;
+}
+
+// socket里还有没读的请求体，边沿触发不会再通知，放到这一轮事件处理之后接着读
+void HttpData::scheduleRead() {
+  if (readScheduled_) return;
+  readScheduled_ = true;
+  loop_->queueInLoop(bind(&HttpData::resumeRead, shared_from_this()));
+}
+
+void HttpData::resumeRead() {
+  readScheduled_ = false;
+  if (connectionState_ == H_DISCONNECTED || error_ || bodyPaused_) return;
+  channel_->setEvents(0);
+  handleRead();
+  handleConn();
+}
+
+/*
+流水线：把inBuffer_里已经收完整的请求依次解析处理，响应按请求的顺序排在outQueue_里，由调用者一次发出。
+为了不让一个客户端占住事件循环，一次最多处理maxPipelined_个请求；输出队列积压到kPipelineHighWater
+也先停下，不再往里排。停下时inBuffer_里剩下的请求由continuePipeline安排接着处理
+*/
+void HttpData::processRequests() {
+  pipelineBlocked_ = false;
+  int handled = 0;
+  while (!error_) {
+    if (state_ == STATE_PARSE_URI &&
+        (handled >= maxPipelined_ ||
+         outQueue_.readableBytes() >= kPipelineHighWater)) {
+      pipelineBlocked_ = inBuffer_.readableBytes() > 0;
+      break;
+    }
     if (state_ == STATE_PARSE_URI) {
       URIState flag = this->parseURI();
       if (flag == PARSE_URI_AGAIN)
         break;
       else if (flag == PARSE_URI_ERROR) {
         perror("2");
-        LOG << "FD = " << fd_ << "," << inBuffer_ << "******";
-        inBuffer_.clear();
+        (LOG << "FD = " << fd_ << ", bad request line (" << lineResult_ << "),")
+            .append(inBuffer_.peek(), inBuffer_.readableBytes());
+        inBuffer_.retrieveAll();
         error_ = true;
-        handleError(fd_, 400, "Bad Request");
+        const char *reason;
+        int status = HttpParser::errorStatus(lineResult_, &reason);
+        handleError(fd_, status, reason);
         break;
       } else
         state_ = STATE_PARSE_HEADERS;
@@ -212,72 +519,180 @@ void HttpData::handleRead() {
         handleError(fd_, 400, "Bad Request");
         break;
       }
-      if (method_ == METHOD_POST) {
-        // POST方法准备
-        state_ = STATE_RECV_BODY;
+      if (!prepareBody()) {
+        error_ = true;
+        break;
+      }
+      const ProxyRoute *route =
+          ProxyRoutes::empty() ? NULL : ProxyRoutes::match(uri_);
+      if (route) {
+        // 转发期间后面的请求先留在inBuffer_里，等proxyDone之后再处理
+        if (!startProxy(route)) {
+          error_ = true;
+          break;
+        }
+        state_ = STATE_PROXY;
+        forwardProxyBody();
+        break;
+      } else if (method_ == METHOD_POST && !bodyChunked_ &&
+                 !headers_.has(HEADER_CONTENT_LENGTH)) {
+        error_ = true;
+        handleError(fd_, 411, "Length Required");
+        break;
       } else {
-        state_ = STATE_ANALYSIS;
+        // POST方法准备：路径上注册了处理程序时请求体边收边交给它，不在inBuffer_里攒成一整块
+        if (method_ == METHOD_POST)
+          bodySink_.reset(BodyHandlers::create("/" + fileName_, this));
+        // 没有处理程序的POST和静态文件不支持的方法，看完头部就拒绝，不回100 Continue也不再收请求体
+        if (!bodySink_ && method_ != METHOD_GET && method_ != METHOD_HEAD) {
+          error_ = true;
+          handleError(fd_, 405, "Method Not Allowed");
+          break;
+        }
+        if (bodySink_) {
+          if (HttpHeaders::equalsIgnoreCase(headers_.get(HEADER_CONNECTION),
+                                            "keep-alive"))
+            keepAlive_ = true;
+          int status = bodySink_->onStart(
+              bodyChunked_ ? BodySink::kUnknownLength : bodyRemain_);
+          if (status != 0) {
+            error_ = true;
+            handleError(fd_, status, bodyErrorReason(status));
+            break;
+          }
+        }
+        if (bodyPending() && HTTPVersion_ == HTTP_11 &&
+            inBuffer_.readableBytes() == 0 &&
+            HttpHeaders::equalsIgnoreCase(headers_.get(HEADER_EXPECT),
+                                          "100-continue"))
+          outQueue_.append("HTTP/1.1 100 Continue\r\n\r\n");
+        state_ = bodyPending() ? STATE_RECV_BODY : STATE_ANALYSIS;
       }
     }
     if (state_ == STATE_RECV_BODY) {
-      int content_length = -1;
-      if (headers_.find("Content-length") != headers_.end()) {
-        content_length = stoi(headers_["Content-length"]);
-      } else {
-        // cout << "(state_ == STATE_RECV_BODY)" << endl;
+      int status = 0;
+      BodyState flag = this->consumeBody(&status);
+      if (flag == BODY_AGAIN)
+        break;
+      else if (flag == BODY_ERROR) {
         error_ = true;
-        handleError(fd_, 400, "Bad Request: Lack of argument (Content-length)");
+        // 响应已经开始发了就没法再回错误页，发完已有的部分后关闭连接
+        if (!responseStarted_) handleError(fd_, status, bodyErrorReason(status));
         break;
       }
-      if (static_cast<int>(inBuffer_.size()) < content_length) break;
       state_ = STATE_ANALYSIS;
     }
     if (state_ == STATE_ANALYSIS) {
       AnalysisState flag = this->analysisRequest();
-      if (flag == ANALYSIS_SUCCESS) {
-        state_ = STATE_FINISH;
-        break;
-      } else {
+      if (flag != ANALYSIS_SUCCESS) {
         // cout << "state_ == STATE_ANALYSIS" << endl;
         error_ = true;
         break;
       }
+      state_ = STATE_FINISH;
     }
-  } while (false);
-  // cout << "state_=" << state_ << endl;
-  if (!error_) {
-    if (outBuffer_.size() > 0) {
-      handleWrite();
-      // events_ |= EPOLLOUT;
-    }
-    // error_ may change
-    if (!error_ && state_ == STATE_FINISH) {
-      this->reset();
-      if (inBuffer_.size() > 0) {
-        if (connectionState_ != H_DISCONNECTING) handleRead();
-      }
+    this->reset();
+    ++handled;
+  }
+  // 出错之前的请求已经有响应排在队列里了，错误页(由handleError排在它们后面)发完再关闭连接
+  if (error_ && !outQueue_.empty()) {
+    error_ = false;
+    connectionState_ = H_DISCONNECTING;
+    inBuffer_.retrieveAll();
+  }
+}
 
-      // if ((keepAlive_ || inBuffer_.size() > 0) && connectionState_ ==
-      // H_CONNECTED)
-      // {
-      //     this->reset();
-      //     events_ |= EPOLLIN;
-      // }
-    } else if (!error_ && connectionState_ != H_DISCONNECTED)
-      events_ |= EPOLLIN;
+// 因为达到上限停下来的请求：输出队列还没发完时由handleWritable发完后接着处理，否则放到这一轮事件处理之后
+void HttpData::continuePipeline() {
+  if (!pipelineBlocked_ || pipelineScheduled_ || error_ || !outQueue_.empty() ||
+      connectionState_ == H_DISCONNECTED)
+    return;
+  pipelineScheduled_ = true;
+  loop_->queueInLoop(bind(&HttpData::resumePipeline, shared_from_this()));
+}
+
+void HttpData::resumePipeline() {
+  pipelineScheduled_ = false;
+  if (connectionState_ == H_DISCONNECTED || error_ || state_ == STATE_PROXY)
+    return;
+  channel_->setEvents(0);
+  runPipeline();
+  handleConn();
+}
+
+void HttpData::runPipeline() {
+  processRequests();
+  if (!error_) {
+    if (!outQueue_.empty()) handleWrite();
+    if (!error_) channel_->getEvents() |= EPOLLIN;
+    continuePipeline();
   }
 }
 
 void HttpData::handleWrite() {
   if (!error_ && connectionState_ != H_DISCONNECTED) {
     __uint32_t &events_ = channel_->getEvents();
-    if (writen(fd_, outBuffer_) < 0) {
+    ssize_t ret = tls_ ? tls_->flush(outQueue_) : sendOutput();
+    if (ret < 0) {
       perror("writen");
       events_ = 0;
       error_ = true;
+      outQueue_.clear();
     }
-    if (outBuffer_.size() > 0) events_ |= EPOLLOUT;//可能由于接收方的滑动窗口大小限制而没写完数据，需要继续监听这个socket上的写就绪事件
+    if (!outQueue_.empty()) events_ |= EPOLLOUT;//可能由于接收方的滑动窗口大小限制而没写完数据，需要继续监听这个socket上的写就绪事件
   }
+  updatePendingBytes();
+}
+
+// socket可写：继续发送剩下的响应；响应发完后，发送期间攒在inBuffer_里的请求要接着处理，边沿触发不会再为它们通知一次
+void HttpData::handleWritable() {
+  if (tls_ && !tls_->established()) {
+    if (tlsHandshake()) handleRead();
+    return;
+  }
+  handleWrite();
+  if (upstream_ && outQueue_.readableBytes() < UpstreamConn::kHighWaterMark / 2)
+    upstream_->resume();
+  if (bodyPaused_ && !error_ && outQueue_.readableBytes() < bodyHighWater_ / 2) {
+    bodyPaused_ = false;
+    handleRead();
+    return;
+  }
+  if (error_ || !outQueue_.empty()) return;
+  // 因为达到上限停下的请求已经在inBuffer_里了，不用再读socket；对端半关闭以后也要处理完
+  if (pipelineBlocked_)
+    runPipeline();
+  else if (connectionState_ == H_CONNECTED && inBuffer_.readableBytes() > 0)
+    handleRead();
+}
+
+// EPOLLERR：零拷贝的完成通知放在socket的错误队列里，也是以EPOLLERR的形式报告的。
+// 收完通知后照常处理同时就绪的读写事件，真正的错误会在读写时暴露出来。
+// 只有通知没有EPOLLOUT时也要试着写一次，handleWrite会在没写完时重新关注EPOLLOUT
+void HttpData::handleErrorEvent() {
+  bool pending = outQueue_.zeroCopyPending();
+  if (outQueue_.reapZeroCopy(fd_) == 0 && !pending) return;
+  __uint32_t revents = channel_->getRevents();
+  if (revents & (EPOLLIN | EPOLLPRI | EPOLLRDHUP)) handleRead();
+  if ((revents & EPOLLOUT) || !outQueue_.empty()) handleWritable();
+  handleConn();
+}
+
+/*
+poller替它收数据的连接(io_uring)，发送也交给poller：队头的内存段做成SENDMSG，和这一轮的其他请求一起提交，
+完成时由sent取走发出的字节，再以EPOLLOUT回调到这里发下一段。文件段和零拷贝照常在这里同步发送
+*/
+ssize_t HttpData::sendOutput() {
+  if (sendError_ != 0) {
+    errno = sendError_;
+    return -1;
+  }
+  if (sendInFlight_) return 0;
+  if (recvByPoller_ && loop_->submitSend(fd_, outQueue_)) {
+    sendInFlight_ = true;
+    return 0;
+  }
+  return outQueue_.flush(fd_);
 }
 
 void HttpData::handleConn() {
@@ -288,7 +703,8 @@ void HttpData::handleConn() {
   if (!error_ && connectionState_ == H_CONNECTED) {
     if (events_ != 0) {
       int timeout = DEFAULT_EXPIRED_TIME;
-      if (keepAlive_) timeout = DEFAULT_KEEP_ALIVE_TIME;
+      // 等上游响应的时间由UpstreamConn的超时控制
+      if (keepAlive_ || upstream_) timeout = DEFAULT_KEEP_ALIVE_TIME;
       if ((events_ & EPOLLIN) && (events_ & EPOLLOUT)) {
         events_ = __uint32_t(0);
         events_ |= EPOLLOUT;
@@ -312,8 +728,10 @@ void HttpData::handleConn() {
       loop_->updatePoller(channel_, timeout);
     }
   } else if (!error_ && connectionState_ == H_DISCONNECTING &&
-             (events_ & EPOLLOUT)) {
+             ((events_ & EPOLLOUT) || upstream_ || pipelineScheduled_)) {
+    // 对端关闭了写端，还要把响应发完；转发中的请求还要等上游的响应，流水线里剩下的请求还要处理
     events_ = (EPOLLOUT | EPOLLET);
+    loop_->updatePoller(channel_, DEFAULT_KEEP_ALIVE_TIME);
   } else {
     // cout << "close with errors" << endl;
     loop_->runInLoop(bind(&HttpData::handleClose, shared_from_this()));//shared_from_this()功能为返回一个当前类的std::share_ptr
@@ -321,172 +739,247 @@ void HttpData::handleConn() {
 }
 
 URIState HttpData::parseURI() {
-  string &str = inBuffer_;
-  string cop = str;
   // 读到完整的请求行再开始解析请求
-  size_t pos = str.find('\r', nowReadPos_);
-  if (pos < 0) {
+  const char *begin = inBuffer_.peek();
+  const char *lf = static_cast<const char *>(
+      memchr(begin, '\n', inBuffer_.readableBytes()));
+  if (lf == NULL) {
     return PARSE_URI_AGAIN;
   }
-  // 去掉请求行所占的空间，节省空间
-  string request_line = str.substr(0, pos);
-  if (str.size() > pos + 1)
-    str = str.substr(pos + 1);
-  else
-    str.clear();
-  // Method
-  int posGet = request_line.find("GET");
-  int posPost = request_line.find("POST");
-  int posHead = request_line.find("HEAD");
-
-  if (posGet >= 0) {
-    pos = posGet;
-    method_ = METHOD_GET;
-  } else if (posPost >= 0) {
-    pos = posPost;
-    method_ = METHOD_POST;
-  } else if (posHead >= 0) {
-    pos = posHead;
-    method_ = METHOD_HEAD;
+  const char *end = (lf > begin && lf[-1] == '\r') ? lf - 1 : lf;
+  // 直接在inBuffer_上解析，字段都指向缓冲区，取完需要的部分后再移动读指针
+  RequestLine line;
+  lineResult_ = HttpParser::parseRequestLine(begin, end, &line);
+  if (lineResult_ != REQUEST_LINE_OK) return PARSE_URI_ERROR;
+  method_ = line.method;
+  HTTPVersion_ = line.version;
+  line.query.copyTo(&query_);
+  if (line.path.empty() || line.target[0] == '/') {
+    line.target.copyTo(&uri_);
   } else {
-    return PARSE_URI_ERROR;
+    // absolute形式只留下路径和查询串，匹配代理规则和转发给上游都按origin形式
+    line.path.copyTo(&uri_);
+    if (!line.query.empty()) uri_ += "?" + query_;
   }
-
-  // filename
-  pos = request_line.find("/", pos);
-  if (pos < 0) {
+  if (line.path.size() > 1)
+    fileName_.assign(line.path.data() + 1, line.path.size() - 1);
+  else
     fileName_ = "index.html";
-    HTTPVersion_ = HTTP_11;
-    return PARSE_URI_SUCCESS;
-  } else {
-    size_t _pos = request_line.find(' ', pos);
-    if (_pos < 0)
-      return PARSE_URI_ERROR;
-    else {
-      if (_pos - pos > 1) {
-        fileName_ = request_line.substr(pos + 1, _pos - pos - 1);
-        size_t __pos = fileName_.find('?');
-        if (__pos >= 0) {
-          fileName_ = fileName_.substr(0, __pos);
-        }
-      }
-
-      else
-        fileName_ = "index.html";
-    }
-    pos = _pos;
-  }
-  // cout << "fileName_: " << fileName_ << endl;
-  // HTTP 版本号
-  pos = request_line.find("/", pos);
-  if (pos < 0)
-    return PARSE_URI_ERROR;
-  else {
-    if (request_line.size() - pos <= 3)
-      return PARSE_URI_ERROR;
-    else {
-      string ver = request_line.substr(pos + 1, 3);
-      if (ver == "1.0")
-        HTTPVersion_ = HTTP_10;
-      else if (ver == "1.1")
-        HTTPVersion_ = HTTP_11;
-      else
-        return PARSE_URI_ERROR;
-    }
-  }
+  // 留下'\n'，parseHeaders会跳过它
+  inBuffer_.retrieve(lf - begin);
   return PARSE_URI_SUCCESS;
 }
 
+// 头部逐行交给HttpParser::parseHeaderLine。只收到半行时读指针退回这一行的开头，
+// 下次收到更多数据后从这一行重新扫描；hState_记着请求行留下的'\n'是否已经跳过
 HeaderState HttpData::parseHeaders() {
-  string &str = inBuffer_;
-  int key_start = -1, key_end = -1, value_start = -1, value_end = -1;
-  int now_read_line_begin = 0;
-  bool notFinish = true;
-  size_t i = 0;
-  for (; i < str.size() && notFinish; ++i) {
-    switch (hState_) {
-      case H_START: {
-        if (str[i] == '\n' || str[i] == '\r') break;
-        hState_ = H_KEY;
-        key_start = i;
-        now_read_line_begin = i;
-        break;
-      }
-      case H_KEY: {
-        if (str[i] == ':') {
-          key_end = i;
-          if (key_end - key_start <= 0) return PARSE_HEADER_ERROR;
-          hState_ = H_COLON;
-        } else if (str[i] == '\n' || str[i] == '\r')
-          return PARSE_HEADER_ERROR;
-        break;
-      }
-      case H_COLON: {
-        if (str[i] == ' ') {
-          hState_ = H_SPACES_AFTER_COLON;
-        } else
+  const char *begin = inBuffer_.peek();
+  const char *end = begin + inBuffer_.readableBytes();
+  const char *p = begin;
+  if (hState_ == H_START) {
+    if (p == end) return PARSE_HEADER_AGAIN;
+    if (*p == '\n') ++p;
+    hState_ = H_LF;
+  }
+  while (true) {
+    HeaderField field;
+    const char *next;
+    switch (HttpParser::parseHeaderLine(p, end, &field, &next)) {
+      case HEADER_LINE_OK: {
+        if (field.value.empty() || next - p > MAX_HEADER_LINE)
           return PARSE_HEADER_ERROR;
+        headers_.add(field.name, field.value);
+        p = next;
         break;
       }
-      case H_SPACES_AFTER_COLON: {
-        hState_ = H_VALUE;
-        value_start = i;
-        break;
-      }
-      case H_VALUE: {
-        if (str[i] == '\r') {
-          hState_ = H_CR;
-          value_end = i;
-          if (value_end - value_start <= 0) return PARSE_HEADER_ERROR;
-        } else if (i - value_start > 255)
-          return PARSE_HEADER_ERROR;
-        break;
+      case HEADER_LINE_END: {
+        hState_ = H_END_LF;
+        inBuffer_.retrieve(next - begin);
+        return PARSE_HEADER_SUCCESS;
       }
-      case H_CR: {
-        if (str[i] == '\n') {
-          hState_ = H_LF;
-          string key(str.begin() + key_start, str.begin() + key_end);
-          string value(str.begin() + value_start, str.begin() + value_end);
-          headers_[key] = value;
-          now_read_line_begin = i;
-        } else
-          return PARSE_HEADER_ERROR;
-        break;
+      case HEADER_LINE_AGAIN: {
+        if (end - p > MAX_HEADER_LINE) return PARSE_HEADER_ERROR;
+        inBuffer_.retrieve(p - begin);
+        return PARSE_HEADER_AGAIN;
       }
-      case H_LF: {
-        if (str[i] == '\r') {
-          hState_ = H_END_CR;
-        } else {
-          key_start = i;
-          hState_ = H_KEY;
+      default:
+        return PARSE_HEADER_ERROR;
+    }
+  }
+}
+
+/*
+解析"bytes=0-99,200-,-50"形式的Range，结果是闭区间[first, last]，已经截到文件长度以内。
+格式不对、单位不是bytes、段数太多时返回RANGE_IGNORE，按没有Range处理回200；
+格式正确但没有一段落在文件内时返回RANGE_UNSATISFIABLE，回416
+*/
+static RangeResult parseRange(const string &spec, off_t size,
+                              vector<pair<off_t, off_t>> &ranges) {
+  static const size_t kMaxRanges = 16;
+  if (spec.compare(0, 6, "bytes=") != 0) return RANGE_IGNORE;
+  size_t pos = 6;
+  while (pos <= spec.size()) {
+    size_t end = spec.find(',', pos);
+    if (end == string::npos) end = spec.size();
+    size_t b = spec.find_first_not_of(" \t", pos);
+    size_t dash = spec.find('-', pos);
+    if (b == string::npos || b >= end || dash == string::npos || dash >= end)
+      return RANGE_IGNORE;
+    char *stop;
+    off_t first = -1, last = -1;
+    if (b < dash) {
+      first = strtoll(spec.c_str() + b, &stop, 10);
+      if (stop != spec.c_str() + dash) return RANGE_IGNORE;
+    }
+    size_t e = spec.find_first_not_of(" \t", dash + 1);
+    if (e != string::npos && e < end) {
+      last = strtoll(spec.c_str() + e, &stop, 10);
+      if (stop == spec.c_str() + e) return RANGE_IGNORE;
+    }
+    if (first < 0) {
+      // "-n"表示最后n个字节
+      if (last <= 0) return last == 0 ? RANGE_UNSATISFIABLE : RANGE_IGNORE;
+      first = last >= size ? 0 : size - last;
+      last = size - 1;
+    } else if (last < 0 || last >= size) {
+      last = size - 1;
+    } else if (last < first) {
+      return RANGE_IGNORE;
+    }
+    if (first < size) ranges.push_back(make_pair(first, last));
+    if (ranges.size() > kMaxRanges) return RANGE_IGNORE;
+    pos = end + 1;
+  }
+  return ranges.empty() ? RANGE_UNSATISFIABLE : RANGE_OK;
+}
+
+// 由mtime和大小生成ETag，文件的任何改动都会改变其中之一
+static string makeETag(const struct stat &st, bool gzip) {
+  char buf[64];
+  snprintf(buf, sizeof buf, "\"%lx-%lx%s\"", static_cast<long>(st.st_mtime),
+           static_cast<long>(st.st_size), gzip ? "-gz" : "");
+  return buf;
+}
+
+// RFC 7231的HTTP-date格式，比如"Sun, 06 Nov 1994 08:49:37 GMT"
+static string httpDate(time_t t) {
+  struct tm tm;
+  gmtime_r(&t, &tm);
+  char buf[64];
+  strftime(buf, sizeof buf, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+  return buf;
+}
+
+/*
+客户端缓存的版本仍然有效时返回true。If-None-Match优先，有它时忽略If-Modified-Since；
+比较ETag时用弱比较，忽略W/前缀，压缩和未压缩两种表示都算匹配。
+*etag是304里要带的ETag：匹配上的那个；"*"或者按If-Modified-Since判断时留空，由调用者按这次会发的表示选
+*/
+bool HttpData::notModified(const struct stat &st, string *etag) {
+  if (headers_.has(HEADER_IF_NONE_MATCH)) {
+    const string value = headers_.get(HEADER_IF_NONE_MATCH).as_string();
+    const string plainEtag = makeETag(st, false), gzEtag = makeETag(st, true);
+    size_t pos = 0;
+    while (pos < value.size()) {
+      size_t end = value.find(',', pos);
+      if (end == string::npos) end = value.size();
+      size_t b = value.find_first_not_of(" \t", pos);
+      size_t e = value.find_last_not_of(" \t", end - 1);
+      if (b != string::npos && b < end && e >= b) {
+        string tag = value.substr(b, e - b + 1);
+        if (tag.compare(0, 2, "W/") == 0) tag = tag.substr(2);
+        if (tag == plainEtag || tag == gzEtag) {
+          *etag = tag;
+          return true;
         }
-        break;
-      }
-      case H_END_CR: {
-        if (str[i] == '\n') {
-          hState_ = H_END_LF;
-        } else
-          return PARSE_HEADER_ERROR;
-        break;
-      }
-      case H_END_LF: {
-        notFinish = false;
-        key_start = i;
-        now_read_line_begin = i;
-        break;
+        if (tag == "*") return true;
       }
+      pos = end + 1;
     }
+    return false;
   }
-  if (hState_ == H_END_LF) {
-    str = str.substr(i);
-    return PARSE_HEADER_SUCCESS;
+  if (!headers_.has(HEADER_IF_MODIFIED_SINCE)) return false;
+  const string since = headers_.get(HEADER_IF_MODIFIED_SINCE).as_string();
+  struct tm tm;
+  memset(&tm, 0, sizeof tm);
+  if (strptime(since.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm) == NULL)
+    return false;
+  return st.st_mtime <= timegm(&tm);
+}
+
+// ContentCache里的完整响应，HEAD只发其中的头部
+void HttpData::appendCachedResponse(const ContentCache::ResponsePtr &response) {
+  if (method_ != METHOD_HEAD) {
+    outQueue_.appendShared(response);
+    return;
   }
-  str = str.substr(now_read_line_begin);
-  return PARSE_HEADER_AGAIN;
+  size_t end = response->find("\r\n\r\n");
+  outQueue_.append(response->substr(0, end == string::npos ? end : end + 4));
+}
+
+// Accept-Encoding里列出了gzip(或者*)，并且没有用q=0明确拒绝
+bool HttpData::acceptsGzip() {
+  if (!headers_.has(HEADER_ACCEPT_ENCODING)) return false;
+  const string value = headers_.get(HEADER_ACCEPT_ENCODING).as_string();
+  size_t pos = value.find("gzip");
+  if (pos == string::npos) pos = value.find('*');
+  if (pos == string::npos) return false;
+  size_t end = value.find(',', pos);
+  string params = value.substr(pos, end == string::npos ? end : end - pos);
+  size_t q = params.find("q=");
+  return q == string::npos || atof(params.c_str() + q + 2) > 0;
+}
+
+// 用pread把整个文件追加到out后面，不改变fd的文件偏移，其他连接可能正共用这个fd做sendfile
+static bool readWholeFile(int fd, off_t size, string &out) {
+  size_t base = out.size();
+  out.resize(base + size);
+  off_t done = 0;
+  while (done < size) {
+    ssize_t n = pread(fd, &out[base + done], size - done, done);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) {
+      out.resize(base);
+      return false;
+    }
+    done += n;
+  }
+  return true;
+}
+
+/*
+这个GET/HEAD的200会不会用gzip编码，和analysisRequest里的判断顺序一致：ContentCache里已有的响应、
+预先压缩的.gz、能缓存的文件当场压缩(压缩后没变小就不用)。304要带上200会用的那个ETag
+*/
+bool HttpData::sendsGzip(const FileCache::EntryPtr &entry, bool compressible) {
+  if (!compressible || !acceptsGzip()) return false;
+  ContentCache &contentCache = ContentCache::instance();
+  const bool cacheable = contentCache.cacheable(entry->st.st_size);
+  if (cacheable) {
+    ContentCache::ResponsePtr response =
+        contentCache.get(fileName_, (keepAlive_ ? 1 : 0) | 2, entry->st);
+    if (response) {
+      size_t end = response->find("\r\n\r\n");
+      return response->find("\r\nContent-Encoding: gzip") < end;
+    }
+  }
+  FileCache *cache = loop_->fileCache();
+  FileCache::EntryPtr gz = cache->lookup(fileName_ + ".gz");
+  if (gz->exists && gz->st.st_mtime >= entry->st.st_mtime) return true;
+  if (!cacheable) return false;
+  shared_ptr<FileHandle> file = cache->open(entry);
+  string content, zipped;
+  return file && readWholeFile(file->fd(), entry->st.st_size, content) &&
+         gzipCompress(content, zipped) && zipped.size() < content.size();
 }
 
 AnalysisState HttpData::analysisRequest() {
   if (method_ == METHOD_POST) {
+    if (bodySink_) {
+      bodySink_->onComplete();
+      bodySink_.reset();
+      return ANALYSIS_SUCCESS;
+    }
     // ------------------------------------------------------
     // My CV stitching handler which requires OpenCV library
     // ------------------------------------------------------
@@ -512,76 +1005,247 @@ AnalysisState HttpData::analysisRequest() {
     // inBuffer_ = inBuffer_.substr(length);
     // return ANALYSIS_SUCCESS;
   } else if (method_ == METHOD_GET || method_ == METHOD_HEAD) {
-    string header;
-    header += "HTTP/1.1 200 OK\r\n";
-    if (headers_.find("Connection") != headers_.end() &&
-        (headers_["Connection"] == "Keep-Alive" ||
-         headers_["Connection"] == "keep-alive")) {
+    if (HttpHeaders::equalsIgnoreCase(headers_.get(HEADER_CONNECTION),
+                                      "keep-alive")) {
       keepAlive_ = true;
-      header += string("Connection: Keep-Alive\r\n") + "Keep-Alive: timeout=" +
-                to_string(DEFAULT_KEEP_ALIVE_TIME) + "\r\n";
     }
+    const bool acceptGzip = acceptsGzip();
+
+    // echo test
+    if (fileName_ == "hello") {
+      static const char hello[] =
+          "HTTP/1.1 200 OK\r\nContent-type: text/plain\r\n\r\nHello World";
+      outQueue_.appendStatic(hello, sizeof hello - 1);
+      return ANALYSIS_SUCCESS;
+    }
+
+    // stat结果和打开的fd都来自本线程的FileCache，命中时不做文件系统调用。
+    // 目录等非普通文件没法sendfile，按不存在处理
+    FileCache *cache = loop_->fileCache();
+    FileCache::EntryPtr entry;
+    if (fileName_ != "favicon.ico") {
+      entry = cache->lookup(fileName_);
+      if (!entry->exists) {
+        handleError(fd_, 404, "Not Found!");
+        return ANALYSIS_ERROR;
+      }
+    }
+
     int dot_pos = fileName_.find('.');
     string filetype;
     if (dot_pos < 0)
       filetype = MimeType::getMime("default");
     else
       filetype = MimeType::getMime(fileName_.substr(dot_pos));
+    // 响应内容随Accept-Encoding变化，要告诉中间的缓存按它区分
+    const bool compressible = MimeType::isCompressible(filetype);
 
-    // echo test
-    if (fileName_ == "hello") {
-      outBuffer_ =
-          "HTTP/1.1 200 OK\r\nContent-type: text/plain\r\n\r\nHello World";
+    // 热点小文件的完整响应在ContentCache里，命中时直接挂上共享的响应，不拼头部也不读文件
+    // 条件请求命中时回不带body的304，只用到FileCache里的stat结果，不打开文件。
+    // 304带上客户端手里那个表示的ETag，和200一样按Accept-Encoding加Vary
+    string matchedETag;
+    if (entry && notModified(entry->st, &matchedETag)) {
+      if (matchedETag.empty())
+        matchedETag = makeETag(entry->st, sendsGzip(entry, compressible));
+      string header = "HTTP/1.1 304 Not Modified\r\n";
+      if (keepAlive_) {
+        header += string("Connection: Keep-Alive\r\n") + "Keep-Alive: timeout=" +
+                  to_string(DEFAULT_KEEP_ALIVE_TIME) + "\r\n";
+      }
+      if (compressible) header += "Vary: Accept-Encoding\r\n";
+      header += "ETag: " + matchedETag + "\r\n";
+      header += "Last-Modified: " + httpDate(entry->st.st_mtime) + "\r\n";
+      header += "Server: WangXin's Web Server\r\n\r\n";
+      outQueue_.append(header);
       return ANALYSIS_SUCCESS;
     }
+
+    ContentCache &contentCache = ContentCache::instance();
+    // 不压缩的类型两种客户端拿到的内容一样，只缓存一份
+    const int variant =
+        (keepAlive_ ? 1 : 0) | (compressible && acceptGzip ? 2 : 0);
+    bool hasRange = headers_.has(HEADER_RANGE);
+    // If-Range里的ETag或者日期和文件当前的对不上，说明客户端手里的那部分已经过时了，要回完整的200
+    if (entry && hasRange && headers_.has(HEADER_IF_RANGE)) {
+      StringPiece ifRange = headers_.get(HEADER_IF_RANGE);
+      if (ifRange != makeETag(entry->st, false) &&
+          ifRange != httpDate(entry->st.st_mtime))
+        hasRange = false;
+    }
+    // HEAD也走ContentCache，头部要和GET回的完全一样(压缩与否、长度、ETag)，只是不带body
+    bool useContentCache = entry &&
+                           (method_ == METHOD_GET || method_ == METHOD_HEAD) &&
+                           !hasRange && contentCache.cacheable(entry->st.st_size);
+    if (useContentCache) {
+      ContentCache::ResponsePtr response =
+          contentCache.get(fileName_, variant, entry->st);
+      if (response) {
+        appendCachedResponse(response);
+        return ANALYSIS_SUCCESS;
+      }
+    }
+
+    // 状态行等到确定是200还是206/416之后再加在header前面
+    string header;
+    if (keepAlive_) {
+      header += string("Connection: Keep-Alive\r\n") + "Keep-Alive: timeout=" +
+                to_string(DEFAULT_KEEP_ALIVE_TIME) + "\r\n";
+    }
     if (fileName_ == "favicon.ico") {
       header += "Content-Type: image/png\r\n";
       header += "Content-Length: " + to_string(sizeof favicon) + "\r\n";
       header += "Server: WangXin's Web Server\r\n";
 
       header += "\r\n";
-      outBuffer_ += header;
-      outBuffer_ += string(favicon, favicon + sizeof favicon);
-      ;
+      outQueue_.append("HTTP/1.1 200 OK\r\n");
+      outQueue_.append(header);
+      outQueue_.appendStatic(favicon, sizeof favicon);
       return ANALYSIS_SUCCESS;
     }
 
-    struct stat sbuf;
-    if (stat(fileName_.c_str(), &sbuf) < 0) {
-      header.clear();
-      handleError(fd_, 404, "Not Found!");
-      return ANALYSIS_ERROR;
-    }
     header += "Content-Type: " + filetype + "\r\n";
-    header += "Content-Length: " + to_string(sbuf.st_size) + "\r\n";
+    if (compressible) header += "Vary: Accept-Encoding\r\n";
     header += "Server: WangXin's Web Server\r\n";
-    // 头部结束
-    header += "\r\n";
-    outBuffer_ += header;
+    header += "Accept-Ranges: bytes\r\n";
+    header += "Last-Modified: " + httpDate(entry->st.st_mtime) + "\r\n";
 
-    if (method_ == METHOD_HEAD) return ANALYSIS_SUCCESS;
+    // 带Range的请求只针对未压缩的原文件，只发送请求的那几段，不经过ContentCache
+    if (hasRange) {
+      vector<pair<off_t, off_t>> ranges;
+      RangeResult result = parseRange(headers_.get(HEADER_RANGE).as_string(),
+                                      entry->st.st_size, ranges);
+      if (result == RANGE_UNSATISFIABLE) {
+        header += "Content-Range: bytes */" + to_string(entry->st.st_size) +
+                  "\r\nContent-Length: 0\r\n\r\n";
+        outQueue_.append("HTTP/1.1 416 Range Not Satisfiable\r\n");
+        outQueue_.append(header);
+        return ANALYSIS_SUCCESS;
+      }
+      if (result == RANGE_OK) {
+        header += "ETag: " + makeETag(entry->st, false) + "\r\n";
+        return analysisRange(entry, filetype, header, ranges);
+      }
+    }
 
-    int src_fd = open(fileName_.c_str(), O_RDONLY, 0);
-    if (src_fd < 0) {
-      outBuffer_.clear();
+    // 有预先压缩好的foo.html.gz且不比原文件旧时，直接发送它
+    FileCache::EntryPtr body = entry;
+    if (compressible && acceptGzip) {
+      FileCache::EntryPtr gz = cache->lookup(fileName_ + ".gz");
+      if (gz->exists && gz->st.st_mtime >= entry->st.st_mtime) {
+        body = gz;
+        header += "Content-Encoding: gzip\r\n";
+      }
+    }
+    // 同一版本文件的压缩和未压缩两种表示要用不同的ETag，预先压缩的文件也按原文件的版本算
+    const string etag = makeETag(entry->st, body != entry);
+
+    if (useContentCache && body == entry) {
+      // 未命中：读出文件内容，和头部拼成完整响应放进缓存，这次也直接发这份响应。
+      // 客户端接受gzip时顺便压缩，压缩结果随响应一起缓存，文件变了(mtime等不同)才重新压缩
+      shared_ptr<FileHandle> file = cache->open(body);
+      string content;
+      if (file && readWholeFile(file->fd(), entry->st.st_size, content)) {
+        string zipped;
+        if (compressible && acceptGzip && gzipCompress(content, zipped) &&
+            zipped.size() < content.size()) {
+          content.swap(zipped);
+          header += "Content-Encoding: gzip\r\n";
+          header += "ETag: " + makeETag(entry->st, true) + "\r\n";
+        } else {
+          header += "ETag: " + etag + "\r\n";
+        }
+        header += "Content-Length: " + to_string(content.size()) + "\r\n\r\n";
+        shared_ptr<string> response(new string("HTTP/1.1 200 OK\r\n"));
+        response->append(header);
+        response->append(content);
+        contentCache.put(fileName_, variant, entry->st, response);
+        appendCachedResponse(response);
+        return ANALYSIS_SUCCESS;
+      }
+    }
+
+    if (method_ == METHOD_HEAD) {
+      header += "ETag: " + etag + "\r\n";
+      header += "Content-Length: " + to_string(body->st.st_size) + "\r\n\r\n";
+      outQueue_.append("HTTP/1.1 200 OK\r\n");
+      outQueue_.append(header);
+      return ANALYSIS_SUCCESS;
+    }
+
+    shared_ptr<FileHandle> file = cache->open(body);
+    if (!file) {
       handleError(fd_, 404, "Not Found!");
       return ANALYSIS_ERROR;
     }
-    void *mmapRet = mmap(NULL, sbuf.st_size, PROT_READ, MAP_PRIVATE, src_fd, 0);
-    close(src_fd);
-    if (mmapRet == (void *)-1) {
-      munmap(mmapRet, sbuf.st_size);
-      outBuffer_.clear();
+    header += "ETag: " + etag + "\r\n";
+    header += "Content-Length: " + to_string(body->st.st_size) + "\r\n";
+    // 头部结束
+    header += "\r\n";
+    // 头部和文件各占一段，文件内容由handleWrite用sendfile直接发送
+    outQueue_.append("HTTP/1.1 200 OK\r\n");
+    outQueue_.append(header);
+    outQueue_.appendFile(file, 0, body->st.st_size);
+    return ANALYSIS_SUCCESS;
+  }
+  // 静态文件只支持GET和HEAD，其余的方法只对反向代理的上游有意义
+  handleError(fd_, 405, "Method Not Allowed");
+  return ANALYSIS_ERROR;
+}
+
+// 回206：一段时body就是文件里的这一段；多段时用multipart/byteranges，每段前面加上分隔行和
+// 这一段自己的头部。文件内容都是文件段，用sendfile只发送请求的范围
+AnalysisState HttpData::analysisRange(const FileCache::EntryPtr &entry,
+                                      const string &filetype, string &header,
+                                      const vector<pair<off_t, off_t>> &ranges) {
+  static const char kBoundary[] = "WangXinWebServerByteRanges";
+  const string total = "/" + to_string(entry->st.st_size);
+  shared_ptr<FileHandle> file;
+  if (method_ != METHOD_HEAD) {
+    file = loop_->fileCache()->open(entry);
+    if (!file) {
       handleError(fd_, 404, "Not Found!");
       return ANALYSIS_ERROR;
     }
-    char *src_addr = static_cast<char *>(mmapRet);
-    outBuffer_ += string(src_addr, src_addr + sbuf.st_size);
-    ;
-    munmap(mmapRet, sbuf.st_size);
+  }
+  outQueue_.append("HTTP/1.1 206 Partial Content\r\n");
+  if (ranges.size() == 1) {
+    off_t first = ranges[0].first, last = ranges[0].second;
+    header += "Content-Range: bytes " + to_string(first) + "-" +
+              to_string(last) + total + "\r\n";
+    header += "Content-Length: " + to_string(last - first + 1) + "\r\n\r\n";
+    outQueue_.append(header);
+    if (file) outQueue_.appendFile(file, first, last - first + 1);
     return ANALYSIS_SUCCESS;
   }
-  return ANALYSIS_ERROR;
+
+  // 各段的分隔头部先拼好，才能算出整个body的长度
+  vector<string> parts;
+  off_t length = 0;
+  for (size_t i = 0; i < ranges.size(); ++i) {
+    parts.push_back(string("\r\n--") + kBoundary + "\r\nContent-Type: " +
+                    filetype + "\r\nContent-Range: bytes " +
+                    to_string(ranges[i].first) + "-" +
+                    to_string(ranges[i].second) + total + "\r\n\r\n");
+    length += parts[i].size() + ranges[i].second - ranges[i].first + 1;
+  }
+  const string closing = string("\r\n--") + kBoundary + "--\r\n";
+  length += closing.size();
+  // multipart自己的Content-Type替换掉文件的类型
+  size_t typeBegin = header.find("Content-Type: ");
+  size_t typeEnd = header.find("\r\n", typeBegin);
+  header.replace(typeBegin, typeEnd - typeBegin,
+                 string("Content-Type: multipart/byteranges; boundary=") +
+                     kBoundary);
+  header += "Content-Length: " + to_string(length) + "\r\n\r\n";
+  outQueue_.append(header);
+  if (!file) return ANALYSIS_SUCCESS;
+  for (size_t i = 0; i < ranges.size(); ++i) {
+    outQueue_.append(parts[i]);
+    outQueue_.appendFile(file, ranges[i].first,
+                         ranges[i].second - ranges[i].first + 1);
+  }
+  outQueue_.append(closing);
+  return ANALYSIS_SUCCESS;
 }
 
 void HttpData::handleError(int fd, int err_num, string short_msg) {
@@ -600,6 +1264,15 @@ void HttpData::handleError(int fd, int err_num, string short_msg) {
   header_buff += "Server: WangXin's Web Server\r\n";
   ;
   header_buff += "\r\n";
+  // 前面的请求还有响应没发完，错误页排在它们后面，保证响应的顺序
+  if (!outQueue_.empty()) {
+    outQueue_.append(header_buff + body_buff);
+    return;
+  }
+  if (tls_) {
+    tls_->writeAll(header_buff + body_buff);
+    return;
+  }
   // 错误处理不考虑writen不完的情况
   sprintf(send_buff, "%s", header_buff.c_str());
   writen(fd, send_buff, strlen(send_buff));
@@ -609,6 +1282,10 @@ void HttpData::handleError(int fd, int err_num, string short_msg) {
 
 void HttpData::handleClose() {
   connectionState_ = H_DISCONNECTED;
+  if (upstream_) {
+    upstream_->abort();
+    upstream_.reset();
+  }
   shared_ptr<HttpData> guard(shared_from_this());
   loop_->removeFromPoller(channel_);
 }
@@ -617,3 +1294,110 @@ void HttpData::newEvent() {
   channel_->setEvents(DEFAULT_EVENT);
   loop_->addToPoller(channel_, DEFAULT_EXPIRED_TIME);
 }
+
+// 反向代理：请求行和请求头改写后交给上游连接，请求体随后边收边转发
+bool HttpData::startProxy(const ProxyRoute *route) {
+  string head = string(HttpParser::methodName(method_)) + " " + uri_ + " HTTP/1.1\r\n";
+  for (size_t i = 0; i < headers_.size(); ++i) {
+    const HeaderId id = headers_.id(i);
+    const StringPiece value = headers_.value(i);
+    // 逐跳头部只对客户端这一段连接有效，到上游那一段一律用keep-alive
+    if (id == HEADER_CONNECTION) {
+      if (HttpHeaders::equalsIgnoreCase(value, "keep-alive")) keepAlive_ = true;
+      continue;
+    }
+    if (id == HEADER_KEEP_ALIVE || id == HEADER_PROXY_CONNECTION) continue;
+    // Transfer-Encoding和Content-Length可能重复出现，下面只转发prepareBody确定下来的那一个
+    if (id == HEADER_TRANSFER_ENCODING || id == HEADER_CONTENT_LENGTH) continue;
+    const StringPiece name = headers_.name(i);
+    head.append(name.data(), name.size()).append(": ");
+    head.append(value.data(), value.size()).append("\r\n");
+  }
+  if (bodyChunked_)
+    head += "Transfer-Encoding: chunked\r\n";
+  else if (headers_.has(HEADER_CONTENT_LENGTH))
+    head += "Content-Length: " + to_string(bodyRemain_) + "\r\n";
+  head += "Connection: keep-alive\r\n\r\n";
+  upstream_ = loop_->upstreamPool()->acquire(route);
+  if (!upstream_) {
+    handleError(fd_, 502, "Bad Gateway");
+    return false;
+  }
+  upstream_->start(shared_from_this(), head, method_ == METHOD_HEAD);
+  return true;
+}
+
+// 请求体原样转发，chunked的请求体只找出在哪结束
+void HttpData::forwardProxyBody() {
+  if (!upstream_ || !bodyPending() || inBuffer_.readableBytes() == 0) return;
+  size_t n;
+  if (bodyChunked_) {
+    n = chunked_.scan(inBuffer_.peek(), inBuffer_.readableBytes());
+    if (chunked_.error()) {
+      // 上游那边的请求没法正常结束了，连同客户端连接一起关掉
+      LOG << "FD = " << fd_ << ", bad chunked body to upstream";
+      upstream_->abort();
+      upstream_.reset();
+      error_ = true;
+      inBuffer_.retrieveAll();
+      return;
+    }
+  } else {
+    n = std::min(bodyRemain_, inBuffer_.readableBytes());
+    bodyRemain_ -= n;
+  }
+  upstream_->sendBody(inBuffer_.peek(), n);
+  inBuffer_.retrieve(n);
+}
+
+void HttpData::appendProxyHead(const string &head, bool mustClose) {
+  outQueue_.append(head);
+  if (mustClose) {
+    keepAlive_ = false;
+    outQueue_.append("Connection: close\r\n");
+  } else if (keepAlive_) {
+    outQueue_.append(string("Connection: Keep-Alive\r\n") +
+                     "Keep-Alive: timeout=" +
+                     to_string(DEFAULT_KEEP_ALIVE_TIME) + "\r\n");
+  }
+  outQueue_.append("\r\n");
+}
+
+// 由上游连接驱动时，照着Channel::handleEvents的顺序处理完再重新注册
+void HttpData::proxyOutput(const char *data, size_t len) {
+  if (connectionState_ == H_DISCONNECTED) return;
+  if (len > 0) outQueue_.append(data, len);
+  channel_->setEvents(0);
+  handleWrite();
+  if (!error_) channel_->getEvents() |= EPOLLIN;
+  handleConn();
+}
+
+void HttpData::proxyDone(bool keepClient) {
+  upstream_.reset();
+  if (connectionState_ == H_DISCONNECTED) return;
+  // 上游没等请求体收完就回了响应，剩下的请求体没法和下一个请求分开，只能关闭连接
+  if (!keepClient || bodyPending()) connectionState_ = H_DISCONNECTING;
+  this->reset();
+  channel_->setEvents(0);
+  handleWrite();
+  // 转发期间攒下的流水线请求接着处理
+  if (!error_ && connectionState_ == H_CONNECTED) handleRead();
+  handleConn();
+}
+
+void HttpData::proxyFailed(int status, const char *msg) {
+  upstream_.reset();
+  if (connectionState_ == H_DISCONNECTED) return;
+  if (status > 0 && outQueue_.empty()) handleError(fd_, status, msg);
+  error_ = true;
+  seperateTimer();
+  loop_->runInLoop(bind(&HttpData::handleClose, shared_from_this()));
+}
+
+void HttpData::resumeProxyBody() {
+  if (connectionState_ == H_DISCONNECTED || state_ != STATE_PROXY) return;
+  channel_->setEvents(0);
+  handleRead();
+  handleConn();
+}
@@ -4,23 +4,35 @@
 #include <sys/epoll.h>
 #include <unistd.h>
 #include <functional>
-#include <map>
 #include <memory>
 #include <string>
 #include <unordered_map>
+#include <utility>
+#include <vector>
+#include "BodySink.h"
+#include "Buffer.h"
+#include "FileCache.h"
+#include "HttpChunked.h"
+#include "HttpHeaders.h"
+#include "HttpParser.h"
+#include "OutputQueue.h"
 #include "Timer.h"
+#include "TlsConn.h"
 
 
 class EventLoop;
 class TimerNode;
 class Channel;
+class UpstreamConn;
+struct ProxyRoute;
 
 enum ProcessState {
   STATE_PARSE_URI = 1,
   STATE_PARSE_HEADERS,
   STATE_RECV_BODY,
   STATE_ANALYSIS,
-  STATE_FINISH
+  STATE_FINISH,
+  STATE_PROXY// 请求交给了反向代理的上游连接，等上游的响应转发完
 };
 
 enum URIState {
@@ -35,26 +47,21 @@ enum HeaderState {
   PARSE_HEADER_ERROR
 };
 
+enum BodyState { BODY_AGAIN = 1, BODY_DONE, BODY_ERROR };
+
 enum AnalysisState { ANALYSIS_SUCCESS = 1, ANALYSIS_ERROR };
 
+enum RangeResult { RANGE_OK = 1, RANGE_IGNORE, RANGE_UNSATISFIABLE };
+
+// 头部的解析进度，总是停在行首，没收完整的一行下次从头重新扫描
 enum ParseState {
-  H_START = 0,
-  H_KEY,
-  H_COLON,
-  H_SPACES_AFTER_COLON,
-  H_VALUE,
-  H_CR,
-  H_LF,
-  H_END_CR,
-  H_END_LF
+  H_START = 0,// 请求行之后，还没跳过请求行留下的'\n'
+  H_LF,// 在一行头部的开头
+  H_END_LF// 头部已经结束
 };
 
 enum ConnectionState { H_CONNECTED = 0, H_DISCONNECTING, H_DISCONNECTED };
 
-enum HttpMethod { METHOD_POST = 1, METHOD_GET, METHOD_HEAD };
-
-enum HttpVersion { HTTP_10 = 1, HTTP_11 };
-
 class MimeType {
  private:
   static void init();
@@ -64,6 +71,7 @@ class MimeType {
 
  public:
   static std::string getMime(const std::string &suffix);
+  static bool isCompressible(const std::string &type);
 
  private:
   static pthread_once_t once_control;
@@ -71,8 +79,9 @@ class MimeType {
 
 class HttpData : public std::enable_shared_from_this<HttpData> {
  public:
-  HttpData(EventLoop *loop, int connfd);
-  ~HttpData() { close(fd_); }
+  // tls为true时连接上先做TLS握手，之后的读写都经过TlsConn
+  HttpData(EventLoop *loop, int connfd, bool tls = false);
+  ~HttpData();// fd_由channel_析构时关闭，这里再close会误关掉已被新连接复用的同号fd
   void reset();
   void seperateTimer();
   void linkTimer(std::shared_ptr<TimerNode> mtimer) {
@@ -83,32 +92,142 @@ class HttpData : public std::enable_shared_from_this<HttpData> {
   EventLoop *getLoop() { return loop_; }
   void handleClose();
   void newEvent();
+  // 一次读事件里最多连续处理的流水线请求数，剩下的放到这一轮事件处理之后，不让一个客户端占住事件循环
+  static void setMaxPipelinedRequests(int n) { maxPipelined_ = n < 1 ? 1 : n; }
+  // 收请求体时输出队列积压到这么多字节就暂停读socket，发出去一半后再接着读
+  static void setBodyHighWater(size_t bytes) { bodyHighWater_ = bytes; }
+
+  // 以下由BodySink调用，生成这个请求的响应
+  const HttpHeaders &requestHeaders() const { return headers_; }
+  // status形如"200 OK"
+  void appendResponse(const std::string &status, const std::string &contentType,
+                      const std::string &body);
+  // 响应的长度事先不知道时用chunked编码，header是状态行和其余的头部，不带结尾的空行
+  void beginChunkedResponse(std::string header);
+  void appendChunk(const char *data, size_t len);
+  void endChunkedResponse();
+
+  // 以下由反向代理的UpstreamConn调用，不会发生在本连接自己的回调中间
+  size_t pendingOutput() const { return outQueue_.readableBytes(); }
+  // 上游响应头已经改写好，补上给客户端的Connection头部，mustClose为true时响应以关闭连接结束
+  void appendProxyHead(const std::string &head, bool mustClose);
+  // 转发一段响应数据并尽量发出去，len可以为0
+  void proxyOutput(const char *data, size_t len);
+  // 响应转发完了，keepClient为false时发完就关闭客户端连接
+  void proxyDone(bool keepClient);
+  // 上游出错，status不为0时回对应的错误页，然后关闭客户端连接
+  void proxyFailed(int status, const char *msg);
+  // 上游的发送缓冲区降下来了，继续读请求体
+  void resumeProxyBody();
+
+  // 以下由IoUringPoller调用：它用provided buffer替连接收数据，在调用读回调之前追加进inBuffer_。
+  // 返回false表示要自己读(TLS连接)，返回true之后handleRead不再读socket
+  bool receiveByPoller();
+  void received(const char *data, size_t len) {
+    inBuffer_.append(data, len);
+    received_ += len;
+  }
+  // err为0表示对端关闭了，否则是recv的errno
+  void receiveFailed(int err) {
+    if (err == 0)
+      peerClosed_ = true;
+    else
+      receiveError_ = true;
+  }
+  // IoUringPoller替它发出了submitSend交过去的数据，res是发出的字节数，负数是-errno
+  void sent(int res) {
+    sendInFlight_ = false;
+    if (res < 0)
+      sendError_ = -res;
+    else if (!error_)
+      outQueue_.sent(static_cast<size_t>(res));
+  }
+  // 还有零拷贝发送没收到完成通知，poller要替它等EPOLLERR
+  bool zeroCopyPending() const { return outQueue_.zeroCopyPending(); }
 
  private:
   EventLoop *loop_;
   std::shared_ptr<Channel> channel_;
   int fd_;
-  std::string inBuffer_;
-  std::string outBuffer_;
+  Buffer inBuffer_;
+  OutputQueue outQueue_;
+  std::unique_ptr<TlsConn> tls_;// 声明在channel_之后，先于fd关闭析构，才能发出close_notify
   bool error_;
   ConnectionState connectionState_;
 
   HttpMethod method_;
   HttpVersion HTTPVersion_;
   std::string fileName_;
+  std::string uri_;// 请求行里的原始URI，带查询字符串
+  std::string query_;// URI里'?'之后的部分
   std::string path_;
+  RequestLineResult lineResult_;// 请求行解析失败的原因
   int nowReadPos_;
   ProcessState state_;
   ParseState hState_;
   bool keepAlive_;
-  std::map<std::string, std::string> headers_;
+  HttpHeaders headers_;
   std::weak_ptr<TimerNode> timer_;
-
+  long reportedPending_;// 已经计入loop_->pendingBytes()的字节数
+  std::shared_ptr<UpstreamConn> upstream_;// STATE_PROXY时转发这个请求的上游连接
+  // 请求体的边界：Content-Length时是还没收的字节数，chunked时由chunked_解码；转发给上游时也用这些
+  size_t bodyRemain_;
+  bool bodyChunked_;
+  ChunkedDecoder chunked_;
+  std::unique_ptr<BodySink> bodySink_;// 这个请求的请求体交给它处理
+  bool chunkedResponse_;// 正在发的响应用chunked编码
+  bool responseStarted_;// 请求体还没收完响应就开始发了，出错时不能再回错误页
+  bool bodyPaused_;// 输出积压超过bodyHighWater_，暂停读请求体
+  bool readScheduled_;// 已经用queueInLoop安排了resumeRead
+  bool pipelineBlocked_;// inBuffer_里还有因为达到上限没处理的请求
+  bool pipelineScheduled_;// 已经用queueInLoop安排了resumePipeline
+  bool recvByPoller_;// 数据由IoUringPoller收好放进inBuffer_
+  size_t received_;// 上次handleRead之后poller放进来的字节数
+  bool peerClosed_;
+  bool receiveError_;
+  bool sendInFlight_;// 队头的数据已经交给poller发送，完成之前不能再写socket
+  int sendError_;// poller发送失败的errno
+
+  static int maxPipelined_;
+  static size_t bodyHighWater_;
+  // 输出队列积压超过这么多字节时，先不处理后面的流水线请求
+  static const size_t kPipelineHighWater = 64 * 1024;
+  static const size_t kBodyReadChunk = 256 * 1024;
+  static const int kBodyReadRounds = 16;
+
+  void updatePendingBytes();
+  // ContentCache里缓存的完整响应
+  void appendCachedResponse(const std::shared_ptr<const std::string> &response);
+
+  bool tlsHandshake();
   void handleRead();
+  void processRequests();
+  void continuePipeline();
+  void resumePipeline();
+  void runPipeline();
+  void scheduleRead();
+  void resumeRead();
   void handleWrite();
+  ssize_t sendOutput();
+  void handleWritable();
   void handleConn();
+  void handleErrorEvent();
   void handleError(int fd, int err_num, std::string short_msg);
   URIState parseURI();
   HeaderState parseHeaders();
+  bool prepareBody();
+  bool bodyPending() const {
+    return bodyChunked_ ? !chunked_.done() : bodyRemain_ > 0;
+  }
+  BodyState consumeBody(int *status);
   AnalysisState analysisRequest();
+  bool startProxy(const ProxyRoute *route);
+  void forwardProxyBody();
+  bool acceptsGzip();
+  bool notModified(const struct stat &st, std::string *etag);
+  bool sendsGzip(const FileCache::EntryPtr &entry, bool compressible);
+  AnalysisState analysisRange(
+      const FileCache::EntryPtr &entry, const std::string &filetype,
+      std::string &header,
+      const std::vector<std::pair<off_t, off_t>> &ranges);
 };
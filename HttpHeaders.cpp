@@ -0,0 +1,130 @@
+// @Author Wang Xin
+
+#include "HttpHeaders.h"
+#include <strings.h>
+
+namespace {
+
+// 顺序和HeaderId一致
+const char *const kKnownNames[HEADER_KNOWN_COUNT] = {
+    "Host",
+    "Connection",
+    "Keep-Alive",
+    "Proxy-Connection",
+    "Content-Length",
+    "Content-Type",
+    "Transfer-Encoding",
+    "Expect",
+    "Accept-Encoding",
+    "Range",
+    "If-Range",
+    "If-None-Match",
+    "If-Modified-Since"};
+
+// 名字的长度和首尾两个字符(忽略大小写)算出哈希，开放定址，表比常用头部的个数大得多，基本一次命中
+const int kTableSize = 64;
+
+inline unsigned hashName(const char *name, size_t len) {
+  unsigned first = static_cast<unsigned char>(name[0]) | 0x20;
+  unsigned last = static_cast<unsigned char>(name[len - 1]) | 0x20;
+  return (static_cast<unsigned>(len) * 31 + first * 7 + last) & (kTableSize - 1);
+}
+
+struct KnownTable {
+  signed char slots[kTableSize];// kKnownNames的下标，-1表示空
+  KnownTable() {
+    for (int i = 0; i < kTableSize; ++i) slots[i] = -1;
+    for (int id = 0; id < HEADER_KNOWN_COUNT; ++id) {
+      unsigned h = hashName(kKnownNames[id], strlen(kKnownNames[id]));
+      while (slots[h] >= 0) h = (h + 1) & (kTableSize - 1);
+      slots[h] = static_cast<signed char>(id);
+    }
+  }
+};
+
+const KnownTable kKnownTable;
+
+// Content-Length只能是十进制数字，非法的值不能交给stoi去抛异常
+bool parseLength(const StringPiece &value, size_t *length) {
+  if (value.empty() || value.size() > 18) return false;
+  size_t n = 0;
+  for (size_t i = 0; i < value.size(); ++i) {
+    if (value[i] < '0' || value[i] > '9') return false;
+    n = n * 10 + (value[i] - '0');
+  }
+  *length = n;
+  return true;
+}
+
+}  // namespace
+
+HeaderId HttpHeaders::lookup(const StringPiece &name) {
+  if (name.empty()) return HEADER_OTHER;
+  for (unsigned h = hashName(name.data(), name.size());;
+       h = (h + 1) & (kTableSize - 1)) {
+    int id = kKnownTable.slots[h];
+    if (id < 0) return HEADER_OTHER;
+    if (equalsIgnoreCase(name, kKnownNames[id]))
+      return static_cast<HeaderId>(id);
+  }
+}
+
+bool HttpHeaders::equalsIgnoreCase(const StringPiece &a, const StringPiece &b) {
+  return a.size() == b.size() && strncasecmp(a.data(), b.data(), a.size()) == 0;
+}
+
+void HttpHeaders::add(const StringPiece &name, const StringPiece &value) {
+  Field field;
+  field.offset = static_cast<uint32_t>(data_.size());
+  field.nameLen = static_cast<uint32_t>(name.size());
+  field.valueLen = static_cast<uint32_t>(value.size());
+  field.id = lookup(name);
+  data_.append(name.data(), name.size());
+  data_.append(value.data(), value.size());
+  if (field.id != HEADER_OTHER)
+    slots_[field.id] = static_cast<int>(fields_.size());
+  fields_.push_back(field);
+}
+
+bool HttpHeaders::find(const StringPiece &name, StringPiece *value) const {
+  HeaderId known = lookup(name);
+  if (known != HEADER_OTHER) {
+    if (!has(known)) return false;
+    *value = get(known);
+    return true;
+  }
+  for (size_t i = fields_.size(); i > 0; --i) {
+    if (equalsIgnoreCase(this->name(i - 1), name)) {
+      *value = this->value(i - 1);
+      return true;
+    }
+  }
+  return false;
+}
+
+BodyFraming HttpHeaders::bodyFraming(size_t *length) const {
+  int lengths = 0, encodings = 0;
+  size_t len = 0;
+  for (size_t i = 0; i < fields_.size(); ++i) {
+    if (fields_[i].id == HEADER_TRANSFER_ENCODING) {
+      ++encodings;
+    } else if (fields_[i].id == HEADER_CONTENT_LENGTH) {
+      // 重复的Content-Length只有值都一样时才接受
+      size_t n;
+      if (!parseLength(value(i), &n) || (lengths > 0 && n != len))
+        return FRAMING_INVALID;
+      len = n;
+      ++lengths;
+    }
+  }
+  if (encodings > 1) return FRAMING_INVALID;
+  if (encodings == 1) {
+    // 只支持chunked一种编码；同时带Content-Length的请求前后两段代理可能理解得不一样，一律拒绝
+    if (!equalsIgnoreCase(get(HEADER_TRANSFER_ENCODING), "chunked"))
+      return FRAMING_UNSUPPORTED;
+    return lengths > 0 ? FRAMING_INVALID : FRAMING_CHUNKED;
+  }
+  if (lengths == 0) return FRAMING_NONE;
+  *length = len;
+  return FRAMING_LENGTH;
+}
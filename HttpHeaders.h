@@ -0,0 +1,97 @@
+// @Author Wang Xin
+
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "base/StringPiece.h"
+#include "base/noncopyable.h"
+
+// 常用的头部，各自在HttpHeaders里有固定的槽位，按编号直接取
+enum HeaderId {
+  HEADER_HOST = 0,
+  HEADER_CONNECTION,
+  HEADER_KEEP_ALIVE,
+  HEADER_PROXY_CONNECTION,
+  HEADER_CONTENT_LENGTH,
+  HEADER_CONTENT_TYPE,
+  HEADER_TRANSFER_ENCODING,
+  HEADER_EXPECT,
+  HEADER_ACCEPT_ENCODING,
+  HEADER_RANGE,
+  HEADER_IF_RANGE,
+  HEADER_IF_NONE_MATCH,
+  HEADER_IF_MODIFIED_SINCE,
+  HEADER_KNOWN_COUNT,
+  HEADER_OTHER = HEADER_KNOWN_COUNT
+};
+
+// 请求体的边界怎么确定(RFC 9112 6.3)
+enum BodyFraming {
+  FRAMING_NONE = 0,// 没有请求体
+  FRAMING_LENGTH,// 按Content-Length
+  FRAMING_CHUNKED,// Transfer-Encoding: chunked
+  FRAMING_UNSUPPORTED,// chunked以外的传输编码
+  FRAMING_INVALID// 长度不合法、几个Content-Length不一致、多个Transfer-Encoding，或者两者同时出现
+};
+
+/*
+一个请求的全部头部，按出现的顺序平铺在一个vector里。
+名字和值拷贝进同一块连续的data_，字段里只记偏移和长度，inBuffer_收更多数据时挪动内存也不受影响；
+常用头部的名字在启动时算好大小写不敏感的哈希表，add时查一次表，之后按HeaderId直接找到槽位。
+clear()只把长度清零，data_和fields_的容量留着给下一个请求用，连接上稳定以后不再分配内存
+*/
+class HttpHeaders : noncopyable {
+ public:
+  HttpHeaders() { clearSlots(); }
+
+  // 同名的头部都保留，常用头部的槽位指向最后出现的那一个
+  void add(const StringPiece &name, const StringPiece &value);
+  void clear() {
+    data_.clear();
+    fields_.clear();
+    clearSlots();
+  }
+
+  bool has(HeaderId id) const { return slots_[id] >= 0; }
+  // 没有这个头部时返回空的StringPiece
+  StringPiece get(HeaderId id) const {
+    return slots_[id] >= 0 ? value(slots_[id]) : StringPiece();
+  }
+  // 按名字查找，大小写不敏感，没有时返回false
+  bool find(const StringPiece &name, StringPiece *value) const;
+
+  size_t size() const { return fields_.size(); }
+  HeaderId id(size_t i) const { return static_cast<HeaderId>(fields_[i].id); }
+  StringPiece name(size_t i) const {
+    return StringPiece(data_.data() + fields_[i].offset, fields_[i].nameLen);
+  }
+  StringPiece value(size_t i) const {
+    return StringPiece(data_.data() + fields_[i].offset + fields_[i].nameLen,
+                       fields_[i].valueLen);
+  }
+
+  // 检查所有的Content-Length和Transfer-Encoding字段，不只是槽位指向的最后一个，
+  // 否则前后两段对重复字段的取舍不一样就会被利用来夹带请求。FRAMING_LENGTH时*length是长度
+  BodyFraming bodyFraming(size_t *length) const;
+
+  // 常用头部的编号，不是常用头部时返回HEADER_OTHER
+  static HeaderId lookup(const StringPiece &name);
+  static bool equalsIgnoreCase(const StringPiece &a, const StringPiece &b);
+
+ private:
+  struct Field {
+    uint32_t offset;// 名字在data_里的位置，值紧跟在名字后面
+    uint32_t nameLen;
+    uint32_t valueLen;
+    int id;
+  };
+
+  void clearSlots() {
+    for (int i = 0; i < HEADER_KNOWN_COUNT; ++i) slots_[i] = -1;
+  }
+
+  std::string data_;
+  std::vector<Field> fields_;
+  int slots_[HEADER_KNOWN_COUNT];// 常用头部在fields_里的下标，-1表示没有
+};
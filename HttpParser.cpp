@@ -0,0 +1,376 @@
+// @Author Wang Xin
+
+#include "HttpParser.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HTTP_PARSER_X86 1
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// 按字节查表，判断是否是RFC 9110里token允许的字符，是否能出现在请求目标里，是否能出现在头部的值里
+struct CharClass {
+  bool token[256];
+  bool target[256];
+  bool value[256];
+  // AVX2按半字节查表用：低4位查tokenLo，高4位查tokenHi，两个结果按位与不为0就是token字符。
+  // token字符都在ASCII里，高4位只有0~7，8个bit正好放得下
+  unsigned char tokenLo[16];
+  unsigned char tokenHi[16];
+  CharClass() {
+    const char *const extra = "!#$%&'*+-.^_`|~";
+    memset(tokenLo, 0, sizeof tokenLo);
+    memset(tokenHi, 0, sizeof tokenHi);
+    for (int c = 0; c < 256; ++c) {
+      token[c] = (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') ||
+                 (c >= 'A' && c <= 'Z') || (c != 0 && strchr(extra, c) != NULL);
+      // 请求目标里不能有空白和控制字符，非ASCII字节放过去，由后面打开文件时处理
+      target[c] = c > 0x20 && c != 0x7f;
+      // 值里可以有HTAB、可见字符和obs-text(0x80以上)
+      value[c] = c == '\t' || (c >= 0x20 && c != 0x7f);
+      if (token[c]) tokenLo[c & 0x0f] |= 1 << (c >> 4);
+    }
+    for (int hi = 0; hi < 8; ++hi) tokenHi[hi] = 1 << hi;
+  }
+};
+
+const CharClass kCharClass;
+
+inline unsigned char uc(char c) { return static_cast<unsigned char>(c); }
+
+// 只有大写的方法名才算数，方法名区分大小写
+bool matchMethod(const char *p, size_t len, HttpMethod *method) {
+  switch (len) {
+    case 3:
+      if (memcmp(p, "GET", 3) == 0) {
+        *method = METHOD_GET;
+        return true;
+      }
+      if (memcmp(p, "PUT", 3) == 0) {
+        *method = METHOD_PUT;
+        return true;
+      }
+      return false;
+    case 4:
+      if (memcmp(p, "POST", 4) == 0) {
+        *method = METHOD_POST;
+        return true;
+      }
+      if (memcmp(p, "HEAD", 4) == 0) {
+        *method = METHOD_HEAD;
+        return true;
+      }
+      return false;
+    case 5:
+      if (memcmp(p, "PATCH", 5) == 0) {
+        *method = METHOD_PATCH;
+        return true;
+      }
+      if (memcmp(p, "TRACE", 5) == 0) {
+        *method = METHOD_TRACE;
+        return true;
+      }
+      return false;
+    case 6:
+      if (memcmp(p, "DELETE", 6) == 0) {
+        *method = METHOD_DELETE;
+        return true;
+      }
+      return false;
+    case 7:
+      if (memcmp(p, "OPTIONS", 7) == 0) {
+        *method = METHOD_OPTIONS;
+        return true;
+      }
+      if (memcmp(p, "CONNECT", 7) == 0) {
+        *method = METHOD_CONNECT;
+        return true;
+      }
+      return false;
+    default:
+      return false;
+  }
+}
+
+// absolute形式"http://host[:port]/path"，返回路径的开头，没有路径时返回NULL，不是absolute形式时返回end
+const char *absolutePath(const char *begin, const char *end) {
+  static const StringPiece kHttp("http://");
+  static const StringPiece kHttps("https://");
+  StringPiece target(begin, end - begin);
+  size_t skip = 0;
+  if (target.starts_with(kHttp))
+    skip = kHttp.size();
+  else if (target.starts_with(kHttps))
+    skip = kHttps.size();
+  else
+    return end;
+  for (const char *p = begin + skip; p < end; ++p)
+    if (*p == '/') return p;
+  return NULL;
+}
+
+const char *scanTokenScalar(const char *p, const char *end) {
+  while (p < end && kCharClass.token[uc(*p)]) ++p;
+  return p;
+}
+
+const char *scanValueScalar(const char *p, const char *end) {
+  while (p < end && kCharClass.value[uc(*p)]) ++p;
+  return p;
+}
+
+#ifdef HTTP_PARSER_X86
+__attribute__((target("sse4.2"))) const char *scanTokenSse42(const char *p,
+                                                             const char *end) {
+  // 不是token字符的字节正好能写成8个区间。最后一个区间里混着'|'和'~'，命中后再查表确认
+  static const char kRanges[16] = {'\0', ' ', '"', '"', '(', ')', ',', ',',
+                                   '/',  '/', ':', '@', '[', ']', '{', '\xff'};
+  const __m128i ranges =
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(kRanges));
+  while (end - p >= 16) {
+    __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    int idx = _mm_cmpestri(ranges, 16, bytes, 16,
+                           _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES |
+                               _SIDD_LEAST_SIGNIFICANT);
+    if (idx == 16) {
+      p += 16;
+      continue;
+    }
+    p += idx;
+    if (!kCharClass.token[uc(*p)]) return p;
+    ++p;
+  }
+  return scanTokenScalar(p, end);
+}
+
+__attribute__((target("sse4.2"))) const char *scanValueSse42(const char *p,
+                                                             const char *end) {
+  // 除HTAB以外的控制字符和DEL
+  static const char kRanges[16] = {'\0', '\x08', '\x0a', '\x1f', '\x7f', '\x7f'};
+  const __m128i ranges =
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(kRanges));
+  while (end - p >= 16) {
+    __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    int idx = _mm_cmpestri(ranges, 6, bytes, 16,
+                           _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES |
+                               _SIDD_LEAST_SIGNIFICANT);
+    if (idx != 16) return p + idx;
+    p += 16;
+  }
+  return scanValueScalar(p, end);
+}
+
+__attribute__((target("avx2"))) const char *scanTokenAvx2(const char *p,
+                                                          const char *end) {
+  const __m256i lo = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(kCharClass.tokenLo)));
+  const __m256i hi = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(kCharClass.tokenHi)));
+  const __m256i nibble = _mm256_set1_epi8(0x0f);
+  const __m256i zero = _mm256_setzero_si256();
+  while (end - p >= 32) {
+    __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+    __m256i l = _mm256_shuffle_epi8(lo, _mm256_and_si256(bytes, nibble));
+    __m256i h = _mm256_shuffle_epi8(
+        hi, _mm256_and_si256(_mm256_srli_epi16(bytes, 4), nibble));
+    unsigned mask = _mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(_mm256_and_si256(l, h), zero));
+    if (mask) return p + __builtin_ctz(mask);
+    p += 32;
+  }
+  return scanTokenSse42(p, end);
+}
+
+__attribute__((target("avx2"))) const char *scanValueAvx2(const char *p,
+                                                          const char *end) {
+  const __m256i space = _mm256_set1_epi8(0x20);
+  const __m256i tab = _mm256_set1_epi8('\t');
+  const __m256i del = _mm256_set1_epi8(0x7f);
+  const __m256i zero = _mm256_setzero_si256();
+  while (end - p >= 32) {
+    __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+    // 有符号比较，0x80以上的字节是负数，要先排除掉
+    __m256i ctl = _mm256_andnot_si256(_mm256_cmpgt_epi8(zero, bytes),
+                                      _mm256_cmpgt_epi8(space, bytes));
+    ctl = _mm256_andnot_si256(_mm256_cmpeq_epi8(bytes, tab), ctl);
+    ctl = _mm256_or_si256(ctl, _mm256_cmpeq_epi8(bytes, del));
+    unsigned mask = _mm256_movemask_epi8(ctl);
+    if (mask) return p + __builtin_ctz(mask);
+    p += 32;
+  }
+  return scanValueSse42(p, end);
+}
+#endif
+
+typedef const char *(*ScanFunc)(const char *, const char *);
+
+struct Scanner {
+  HttpParser::ScanImpl impl;
+  ScanFunc token;
+  ScanFunc value;
+};
+
+HttpParser::ScanImpl supportedScanImpl() {
+#ifdef HTTP_PARSER_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) return HttpParser::SCAN_AVX2;
+  if (__builtin_cpu_supports("sse4.2")) return HttpParser::SCAN_SSE42;
+#endif
+  return HttpParser::SCAN_SCALAR;
+}
+
+Scanner makeScanner(HttpParser::ScanImpl impl) {
+  Scanner scanner = {HttpParser::SCAN_SCALAR, scanTokenScalar,
+                     scanValueScalar};
+#ifdef HTTP_PARSER_X86
+  if (impl == HttpParser::SCAN_AVX2) {
+    scanner.impl = impl;
+    scanner.token = scanTokenAvx2;
+    scanner.value = scanValueAvx2;
+  } else if (impl == HttpParser::SCAN_SSE42) {
+    scanner.impl = impl;
+    scanner.token = scanTokenSse42;
+    scanner.value = scanValueSse42;
+  }
+#endif
+  return scanner;
+}
+
+Scanner g_scanner = makeScanner(supportedScanImpl());
+
+}  // namespace
+
+RequestLineResult HttpParser::parseRequestLine(const char *begin,
+                                               const char *end,
+                                               RequestLine *line) {
+  // 方法
+  const char *p = begin;
+  while (p < end && kCharClass.token[uc(*p)]) ++p;
+  if (p == end) return REQUEST_LINE_MALFORMED;
+  if (p == begin || *p != ' ') return REQUEST_LINE_BAD_METHOD;
+  if (!matchMethod(begin, p - begin, &line->method))
+    return REQUEST_LINE_UNKNOWN_METHOD;
+
+  // 请求目标，顺便记下第一个'?'
+  const char *targetBegin = ++p;
+  const char *question = NULL;
+  for (; p < end && *p != ' '; ++p) {
+    if (!kCharClass.target[uc(*p)]) return REQUEST_LINE_BAD_TARGET;
+    if (*p == '?' && question == NULL) question = p;
+  }
+  if (p == end) return REQUEST_LINE_MALFORMED;
+  const char *targetEnd = p;
+  if (targetBegin == targetEnd) return REQUEST_LINE_BAD_TARGET;
+  line->target.set(targetBegin, targetEnd - targetBegin);
+
+  // 版本，只有"HTTP/x.y"一种写法，后面不能再有东西
+  const char *ver = p + 1;
+  const size_t verLen = end - ver;
+  if (verLen < 8 || memcmp(ver, "HTTP/", 5) != 0 || ver[5] < '0' ||
+      ver[5] > '9' || ver[6] != '.' || ver[7] < '0' || ver[7] > '9')
+    return REQUEST_LINE_BAD_VERSION;
+  if (verLen > 8) return REQUEST_LINE_MALFORMED;
+  if (ver[5] != '1' || ver[7] > '1') return REQUEST_LINE_UNSUPPORTED_VERSION;
+  line->version = ver[7] == '1' ? HTTP_11 : HTTP_10;
+
+  // 按请求目标的形式取出路径和查询串
+  const char *pathEnd = question ? question : targetEnd;
+  if (question)
+    line->query.set(question + 1, targetEnd - question - 1);
+  else
+    line->query.clear();
+  if (line->method == METHOD_CONNECT) {
+    // authority形式：host:port，没有路径也没有查询串
+    if (*targetBegin == '/' || *targetBegin == '*' || question)
+      return REQUEST_LINE_BAD_TARGET;
+    line->path.clear();
+  } else if (*targetBegin == '/') {
+    line->path.set(targetBegin, pathEnd - targetBegin);
+  } else if (*targetBegin == '*') {
+    if (line->method != METHOD_OPTIONS || targetEnd - targetBegin != 1)
+      return REQUEST_LINE_BAD_TARGET;
+    line->path.clear();
+  } else {
+    const char *path = absolutePath(targetBegin, pathEnd);
+    if (path == pathEnd) return REQUEST_LINE_BAD_TARGET;
+    if (path)
+      line->path.set(path, pathEnd - path);
+    else
+      line->path = StringPiece("/", 1);
+  }
+  return REQUEST_LINE_OK;
+}
+
+HeaderLineResult HttpParser::parseHeaderLine(const char *begin,
+                                             const char *end,
+                                             HeaderField *field,
+                                             const char **next) {
+  if (begin == end) return HEADER_LINE_AGAIN;
+  if (*begin == '\r') {
+    if (end - begin < 2) return HEADER_LINE_AGAIN;
+    if (begin[1] != '\n') return HEADER_LINE_ERROR;
+    *next = begin + 2;
+    return HEADER_LINE_END;
+  }
+  // 名字不能为空，名字和':'之间不能有空白
+  const char *colon = g_scanner.token(begin, end);
+  if (colon == end) return HEADER_LINE_AGAIN;
+  if (colon == begin || *colon != ':') return HEADER_LINE_ERROR;
+  const char *value = colon + 1;
+  while (value < end && (*value == ' ' || *value == '\t')) ++value;
+  const char *cr = g_scanner.value(value, end);
+  if (cr == end) return HEADER_LINE_AGAIN;
+  if (*cr != '\r') return HEADER_LINE_ERROR;
+  if (end - cr < 2) return HEADER_LINE_AGAIN;
+  if (cr[1] != '\n') return HEADER_LINE_ERROR;
+  const char *valueEnd = cr;
+  while (valueEnd > value && (valueEnd[-1] == ' ' || valueEnd[-1] == '\t'))
+    --valueEnd;
+  field->name.set(begin, colon - begin);
+  field->value.set(value, valueEnd - value);
+  *next = cr + 2;
+  return HEADER_LINE_OK;
+}
+
+const char *HttpParser::scanToken(const char *begin, const char *end) {
+  return g_scanner.token(begin, end);
+}
+
+const char *HttpParser::scanFieldValue(const char *begin, const char *end) {
+  return g_scanner.value(begin, end);
+}
+
+HttpParser::ScanImpl HttpParser::scanImpl() { return g_scanner.impl; }
+
+HttpParser::ScanImpl HttpParser::setScanImpl(ScanImpl impl) {
+  ScanImpl supported = supportedScanImpl();
+  g_scanner = makeScanner(impl < supported ? impl : supported);
+  return g_scanner.impl;
+}
+
+const char *HttpParser::scanImplName(ScanImpl impl) {
+  static const char *const kNames[] = {"scalar", "sse4.2", "avx2"};
+  return kNames[impl];
+}
+
+int HttpParser::errorStatus(RequestLineResult result, const char **reason) {
+  switch (result) {
+    case REQUEST_LINE_UNKNOWN_METHOD:
+      *reason = "Not Implemented";
+      return 501;
+    case REQUEST_LINE_UNSUPPORTED_VERSION:
+      *reason = "HTTP Version Not Supported";
+      return 505;
+    default:
+      *reason = "Bad Request";
+      return 400;
+  }
+}
+
+const char *HttpParser::methodName(HttpMethod method) {
+  static const char *const kMethodNames[] = {
+      "", "POST", "GET", "HEAD", "PUT", "DELETE", "OPTIONS", "PATCH", "CONNECT",
+      "TRACE"};
+  return kMethodNames[method];
+}
@@ -0,0 +1,85 @@
+// @Author Wang Xin
+
+#pragma once
+#include "base/StringPiece.h"
+
+enum HttpMethod {
+  METHOD_POST = 1,
+  METHOD_GET,
+  METHOD_HEAD,
+  METHOD_PUT,
+  METHOD_DELETE,
+  METHOD_OPTIONS,
+  METHOD_PATCH,
+  METHOD_CONNECT,
+  METHOD_TRACE
+};
+
+enum HttpVersion { HTTP_10 = 1, HTTP_11 };
+
+enum RequestLineResult {
+  REQUEST_LINE_OK = 0,
+  REQUEST_LINE_BAD_METHOD,// 方法不是合法的token
+  REQUEST_LINE_UNKNOWN_METHOD,// 合法的token，但不是支持的方法
+  REQUEST_LINE_BAD_TARGET,// 请求目标为空、含有控制字符或者形式和方法不匹配
+  REQUEST_LINE_BAD_VERSION,// 不是HTTP/x.y的形式
+  REQUEST_LINE_UNSUPPORTED_VERSION,// HTTP/1.0和HTTP/1.1以外的版本
+  REQUEST_LINE_MALFORMED// 分隔符不对、缺少部分或者行尾有多余的内容
+};
+
+enum HeaderLineResult {
+  HEADER_LINE_OK = 0,// 解析出一个头部
+  HEADER_LINE_END,// 空行，头部结束
+  HEADER_LINE_AGAIN,// 这一行还没收完整
+  HEADER_LINE_ERROR
+};
+
+// 解析出来的请求行，各个字段都指向传入的那一行，不拷贝
+struct RequestLine {
+  HttpMethod method;
+  HttpVersion version;
+  StringPiece target;// 请求目标原样，转发给上游时用
+  StringPiece path;// 路径部分，不含查询串；CONNECT的authority形式没有路径
+  StringPiece query;// '?'之后的部分，不含'?'
+};
+
+// 一个头部，name和value都指向缓冲区，value去掉了两边的空白
+struct HeaderField {
+  StringPiece name;
+  StringPiece value;
+};
+
+/*
+请求行和头部的解析器：一遍扫描，不分配内存。
+  method SP request-target SP HTTP-version
+方法按RFC 9110的全集识别(GET HEAD POST PUT DELETE OPTIONS PATCH CONNECT TRACE)，只比较开头的方法名，
+路径里出现"GET"之类的字符串不会影响结果。请求目标支持origin形式("/a/b?x=1")、absolute形式
+("http://host/a")、OPTIONS的"*"和CONNECT的authority形式("host:443")。
+头部按行解析，找':'和行尾用SIMD一次检查16(SSE4.2)或32(AVX2)个字节，同时成批检查头部名字是不是
+都是token字符；用哪一种在启动时按CPU支持的指令集选定，都不支持时逐字节查表
+*/
+class HttpParser {
+ public:
+  enum ScanImpl { SCAN_SCALAR = 0, SCAN_SSE42, SCAN_AVX2 };
+
+  // [begin, end)是不含CRLF的一行(行尾的'\r'由调用者去掉)，失败时line的内容没有意义
+  static RequestLineResult parseRequestLine(const char *begin, const char *end,
+                                            RequestLine *line);
+  // 从begin开始解析一行"name: value\r\n"，成功时*next指向下一行的开头；
+  // 遇到空行返回HEADER_LINE_END，*next指向头部之后的第一个字节
+  static HeaderLineResult parseHeaderLine(const char *begin, const char *end,
+                                          HeaderField *field,
+                                          const char **next);
+  // 第一个不是token字符的位置，没有时返回end
+  static const char *scanToken(const char *begin, const char *end);
+  // 第一个除HTAB以外的控制字符(正常情况下是行尾的'\r')的位置，没有时返回end
+  static const char *scanFieldValue(const char *begin, const char *end);
+  static ScanImpl scanImpl();
+  // 换用指定的实现(CPU不支持时退回能用的最好的一种)，返回实际用的实现。给测试和基准用
+  static ScanImpl setScanImpl(ScanImpl impl);
+  static const char *scanImplName(ScanImpl impl);
+
+  // 解析失败应该回的状态码和原因短语
+  static int errorStatus(RequestLineResult result, const char **reason);
+  static const char *methodName(HttpMethod method);
+};
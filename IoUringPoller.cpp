@@ -0,0 +1,481 @@
+// @Author Wang Xin
+
+#include "IoUringPoller.h"
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include "base/Logging.h"
+
+const unsigned IoUringPoller::kEntries;
+const uint64_t IoUringPoller::kIgnoredUserData;
+const unsigned IoUringPoller::kRecvBuffers;
+const unsigned IoUringPoller::kRecvBufferSize;
+const uint16_t IoUringPoller::kBufferGroup;
+
+static const int POLLWAIT_TIME = 10000;// 毫秒，和EPOLLWAIT_TIME一致
+
+IoUringPoller *IoUringPoller::create() {
+  IoUringPoller *poller = new IoUringPoller();
+  if (!poller->init()) {
+    delete poller;
+    return NULL;
+  }
+  return poller;
+}
+
+IoUringPoller::IoUringPoller()
+    : ringFd_(-1),
+      sqRing_(MAP_FAILED),
+      sqRingSize_(0),
+      cqRing_(MAP_FAILED),
+      cqRingSize_(0),
+      sqes_(static_cast<struct io_uring_sqe *>(MAP_FAILED)),
+      sqesSize_(0),
+      toSubmit_(0),
+      recvBuffers_(NULL),
+      acceptMultishot_(true) {
+  memset(generation_, 0, sizeof generation_);
+  memset(opGeneration_, 0, sizeof opGeneration_);
+  memset(armedEvents_, 0, sizeof armedEvents_);
+  memset(mode_, 0, sizeof mode_);
+  memset(opArmed_, 0, sizeof opArmed_);
+  memset(sendArmed_, 0, sizeof sendArmed_);
+  memset(revents_, 0, sizeof revents_);
+}
+
+IoUringPoller::~IoUringPoller() {
+  for (std::map<int, std::deque<int> >::iterator it = accepted_.begin();
+       it != accepted_.end(); ++it) {
+    for (size_t i = 0; i < it->second.size(); ++i)
+      if (it->second[i] >= 0) close(it->second[i]);
+  }
+  if (recvBuffers_) munmap(recvBuffers_, kRecvBuffers * kRecvBufferSize);
+  if (sqes_ != MAP_FAILED) munmap(sqes_, sqesSize_);
+  if (cqRing_ != MAP_FAILED && cqRing_ != sqRing_) munmap(cqRing_, cqRingSize_);
+  if (sqRing_ != MAP_FAILED) munmap(sqRing_, sqRingSize_);
+  if (ringFd_ >= 0) close(ringFd_);
+}
+
+bool IoUringPoller::init() {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof params);
+  // 所有channel的multishot poll都可能同时产生完成事件，CQ开得比SQ大
+  params.flags = IORING_SETUP_CQSIZE;
+  params.cq_entries = kEntries * 4;
+  ringFd_ = static_cast<int>(syscall(__NR_io_uring_setup, kEntries, &params));
+  if (ringFd_ < 0) return false;
+  /*
+  等待时带超时需要EXT_ARG(5.11)；EPOLLET在掩码的第31位，需要POLL_32BITS；
+  multishot poll是5.13加入的，没有单独的特性位，用同一版本加入的RSRC_TAGS判断
+  */
+  const unsigned required = IORING_FEAT_EXT_ARG | IORING_FEAT_NODROP |
+                            IORING_FEAT_POLL_32BITS | IORING_FEAT_RSRC_TAGS;
+  if ((params.features & required) != required) return false;
+
+  sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cqRingSize_ =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    if (cqRingSize_ > sqRingSize_) sqRingSize_ = cqRingSize_;
+    cqRingSize_ = sqRingSize_;
+  }
+  sqRing_ = mmap(NULL, sqRingSize_, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_SQ_RING);
+  if (sqRing_ == MAP_FAILED) return false;
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    cqRing_ = sqRing_;
+  } else {
+    cqRing_ = mmap(NULL, cqRingSize_, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_CQ_RING);
+    if (cqRing_ == MAP_FAILED) return false;
+  }
+  sqesSize_ = params.sq_entries * sizeof(struct io_uring_sqe);
+  sqes_ = static_cast<struct io_uring_sqe *>(
+      mmap(NULL, sqesSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+           ringFd_, IORING_OFF_SQES));
+  if (sqes_ == MAP_FAILED) return false;
+
+  char *sq = static_cast<char *>(sqRing_);
+  sqHead_ = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+  sqTail_ = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+  sqMask_ = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+  sqEntries_ = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_entries);
+  sqArray_ = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+  char *cq = static_cast<char *>(cqRing_);
+  cqHead_ = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+  cqTail_ = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+  cqMask_ = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+  cqes_ = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+
+  // 内核不支持provided buffer时连接照常由handleRead自己读
+  if (!initBuffers())
+    LOG << "io_uring provided buffers are not available, use poll for reads";
+  return true;
+}
+
+bool IoUringPoller::initBuffers() {
+  // 缓冲区只在用到时才分配物理内存
+  void *buffers = mmap(NULL, kRecvBuffers * kRecvBufferSize, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (buffers == MAP_FAILED) return false;
+  // 一次把所有缓冲区交给内核，同步等它完成，这时CQ里不会有别的完成事件
+  struct io_uring_sqe *sqe = getSqe();
+  sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+  sqe->fd = kRecvBuffers;
+  sqe->addr = reinterpret_cast<uint64_t>(buffers);
+  sqe->len = kRecvBufferSize;
+  sqe->buf_group = kBufferGroup;
+  sqe->off = 0;
+  sqe->user_data = kIgnoredUserData;
+  int ret = enter(toSubmit_, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+  toSubmit_ = 0;
+  unsigned head = *cqHead_;
+  if (ret < 0 || head == __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE) ||
+      cqes_[head & cqMask_].res < 0) {
+    munmap(buffers, kRecvBuffers * kRecvBufferSize);
+    return false;
+  }
+  __atomic_store_n(cqHead_, head + 1, __ATOMIC_RELEASE);
+  recvBuffers_ = static_cast<char *>(buffers);
+  return true;
+}
+
+// 把缓冲区还给内核，和这一轮的其他请求一起提交
+void IoUringPoller::recycleBuffer(uint16_t bid) {
+  struct io_uring_sqe *sqe = getSqe();
+  sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+  sqe->fd = 1;
+  sqe->addr = reinterpret_cast<uint64_t>(recvBuffers_ + bid * kRecvBufferSize);
+  sqe->len = kRecvBufferSize;
+  sqe->buf_group = kBufferGroup;
+  sqe->off = bid;
+  sqe->user_data = kIgnoredUserData;
+}
+
+int IoUringPoller::enter(unsigned toSubmit, unsigned minComplete,
+                         unsigned flags, const void *arg, size_t argSize) {
+  int ret;
+  do {
+    ret = static_cast<int>(syscall(__NR_io_uring_enter, ringFd_, toSubmit,
+                                   minComplete, flags, arg, argSize));
+  } while (ret < 0 && errno == EINTR);
+  return ret;
+}
+
+// SQ满了就先把已有的请求提交掉
+struct io_uring_sqe *IoUringPoller::getSqe() {
+  unsigned tail = *sqTail_;
+  if (tail - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE) >= sqEntries_) {
+    enter(toSubmit_, 0, 0, NULL, 0);
+    toSubmit_ = 0;
+  }
+  unsigned index = tail & sqMask_;
+  struct io_uring_sqe *sqe = &sqes_[index];
+  memset(sqe, 0, sizeof *sqe);
+  sqArray_[index] = index;
+  __atomic_store_n(sqTail_, tail + 1, __ATOMIC_RELEASE);
+  ++toSubmit_;
+  return sqe;
+}
+
+void IoUringPoller::armPoll(int fd, uint32_t events) {
+  ++generation_[fd];
+  struct io_uring_sqe *sqe = getSqe();
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = fd;
+  sqe->len = IORING_POLL_ADD_MULTI;
+  sqe->poll32_events = events;
+  sqe->user_data = userData(OP_POLL, fd, generation_[fd]);
+  armedEvents_[fd] = events;
+}
+
+void IoUringPoller::cancelPoll(int fd) {
+  if (armedEvents_[fd] == 0) return;
+  struct io_uring_sqe *sqe = getSqe();
+  sqe->opcode = IORING_OP_POLL_REMOVE;
+  sqe->fd = -1;
+  sqe->addr = userData(OP_POLL, fd, generation_[fd]);
+  sqe->user_data = kIgnoredUserData;
+  armedEvents_[fd] = 0;
+  // 被取消的请求可能已经产生了还没处理的完成事件，换一个generation让它们失效
+  ++generation_[fd];
+}
+
+// 一直有效，每收下一个连接产生一个完成事件，出错时内核终止它
+void IoUringPoller::armAccept(int fd) {
+  struct io_uring_sqe *sqe = getSqe();
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = fd;
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->user_data = userData(OP_ACCEPT, fd, opGeneration_[fd]);
+  opArmed_[fd] = true;
+}
+
+// 有数据时由内核从环里选一个缓冲区收进去，socket没有数据时内核自己等，不占用缓冲区
+void IoUringPoller::armRecv(int fd) {
+  struct io_uring_sqe *sqe = getSqe();
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = fd;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = kBufferGroup;
+  sqe->len = kRecvBufferSize;
+  sqe->user_data = userData(OP_RECV, fd, opGeneration_[fd]);
+  opArmed_[fd] = true;
+}
+
+void IoUringPoller::cancelOp(int fd) {
+  if (!opArmed_[fd]) return;
+  struct io_uring_sqe *sqe = getSqe();
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = -1;
+  sqe->addr = userData(mode_[fd] == MODE_ACCEPT ? OP_ACCEPT : OP_RECV, fd,
+                       opGeneration_[fd]);
+  sqe->user_data = kIgnoredUserData;
+  opArmed_[fd] = false;
+}
+
+void IoUringPoller::cancelSend(int fd) {
+  if (!sendArmed_[fd]) return;
+  struct io_uring_sqe *sqe = getSqe();
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = -1;
+  sqe->addr = userData(OP_SEND, fd, opGeneration_[fd]);
+  sqe->user_data = kIgnoredUserData;
+  sendArmed_[fd] = false;
+}
+
+// 按channel要的事件补上缺的请求，已经在途并且不用改的请求不动，所以掩码不变时什么都不用做
+void IoUringPoller::arm(int fd, uint32_t events) {
+  uint32_t pollEvents = events;
+  if (mode_[fd] == MODE_ACCEPT) {
+    if ((events & EPOLLIN) && !opArmed_[fd]) armAccept(fd);
+    pollEvents = 0;
+  } else if (mode_[fd] == MODE_RECV || mode_[fd] == MODE_RECV_DONE) {
+    if (mode_[fd] == MODE_RECV && (events & EPOLLIN) && !opArmed_[fd])
+      armRecv(fd);
+    // 读由RECV完成，poll只用来等可写；SENDMSG在途时它的完成事件就是EPOLLOUT，也不用等
+    pollEvents = (events & EPOLLOUT) && !sendArmed_[fd]
+                     ? events & ~(EPOLLIN | EPOLLPRI | EPOLLRDHUP)
+                     : 0;
+    // MSG_ZEROCOPY的完成通知只以EPOLLERR报告，RECV等不到它，还有没收回的发送时poll要留着
+    if (pollEvents == 0 && fd2http_[fd] && fd2http_[fd]->zeroCopyPending())
+      pollEvents = (events & EPOLLET) | EPOLLERR;
+  }
+  if (pollEvents == armedEvents_[fd]) return;
+  cancelPoll(fd);
+  if (pollEvents != 0) armPoll(fd, pollEvents);
+}
+
+void IoUringPoller::addChannel(SP_Channel request, int timeout) {
+  int fd = request->getFd();
+  registerChannel(request, timeout);
+  request->EqualAndUpdateLastEvents();
+  ++opGeneration_[fd];
+  opArmed_[fd] = false;
+  sendArmed_[fd] = false;
+  mode_[fd] = MODE_POLL;
+  if (request->isListening()) {
+    if (acceptMultishot_) mode_[fd] = MODE_ACCEPT;
+  } else if (recvBuffers_ && fd2http_[fd] && fd2http_[fd]->receiveByPoller()) {
+    mode_[fd] = MODE_RECV;
+  }
+  arm(fd, request->getEvents());
+}
+
+void IoUringPoller::modChannel(SP_Channel request, int timeout) {
+  if (timeout > 0) add_timer(request, timeout);
+  request->EqualAndUpdateLastEvents();
+  arm(request->getFd(), request->getEvents());
+}
+
+void IoUringPoller::delChannel(SP_Channel request) {
+  int fd = request->getFd();
+  cancelPoll(fd);
+  cancelOp(fd);
+  cancelSend(fd);
+  // 已经完成还没处理的ACCEPT、RECV和SENDMSG一并作废
+  ++opGeneration_[fd];
+  mode_[fd] = MODE_POLL;
+  std::map<int, std::deque<int> >::iterator it = accepted_.find(fd);
+  if (it != accepted_.end()) {
+    for (size_t i = 0; i < it->second.size(); ++i)
+      if (it->second[i] >= 0) close(it->second[i]);
+    accepted_.erase(it);
+  }
+  unregisterChannel(fd);
+}
+
+int IoUringPoller::acceptConn(int listenFd, struct sockaddr *addr,
+                              socklen_t *addrLen) {
+  std::map<int, std::deque<int> >::iterator it = accepted_.find(listenFd);
+  if (it == accepted_.end() || it->second.empty()) {
+    // 没有用multishot accept的监听socket照常accept
+    if (mode_[listenFd] != MODE_ACCEPT)
+      return Poller::acceptConn(listenFd, addr, addrLen);
+    errno = EAGAIN;
+    return -1;
+  }
+  int fd = it->second.front();
+  it->second.pop_front();
+  if (fd < 0) {
+    errno = -fd;
+    return -1;
+  }
+  // multishot accept不带对端地址，要用时再查
+  if (addr && getpeername(fd, addr, addrLen) < 0) *addrLen = 0;
+  return fd;
+}
+
+// 只给由RECV收数据的连接用，TLS连接和没有provided buffer时照常自己写
+bool IoUringPoller::submitSend(int fd, OutputQueue &queue) {
+  if ((mode_[fd] != MODE_RECV && mode_[fd] != MODE_RECV_DONE) || sendArmed_[fd])
+    return false;
+  uint64_t key = userData(OP_SEND, fd, opGeneration_[fd]);
+  PendingSend &send = sends_[key];
+  int flags = 0;
+  int iovcnt = queue.prepareSend(fd, send.iov, OutputQueue::kMaxIov,
+                                 send.pinned, flags);
+  if (iovcnt == 0) {
+    sends_.erase(key);
+    return false;
+  }
+  memset(&send.msg, 0, sizeof send.msg);
+  send.msg.msg_iov = send.iov;
+  send.msg.msg_iovlen = iovcnt;
+  struct io_uring_sqe *sqe = getSqe();
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<uint64_t>(&send.msg);
+  sqe->msg_flags = static_cast<uint32_t>(flags);
+  sqe->user_data = key;
+  sendArmed_[fd] = true;
+  return true;
+}
+
+void IoUringPoller::handleSend(int fd, const struct io_uring_cqe &cqe) {
+  if (static_cast<uint32_t>(cqe.user_data >> 32) == opGeneration_[fd]) {
+    sendArmed_[fd] = false;
+    const std::shared_ptr<HttpData> &conn = fd2http_[fd];
+    if (conn) {
+      conn->sent(cqe.res);
+      revents_[fd] |= EPOLLOUT;
+    }
+  }
+  sends_.erase(cqe.user_data);
+}
+
+void IoUringPoller::handleAccept(int fd, const struct io_uring_cqe &cqe) {
+  if (static_cast<uint32_t>(cqe.user_data >> 32) != opGeneration_[fd]) {
+    if (cqe.res >= 0) close(cqe.res);
+    return;
+  }
+  if (!(cqe.flags & IORING_CQE_F_MORE)) {
+    opArmed_[fd] = false;
+    if (cqe.res == -EINVAL && acceptMultishot_) {
+      // 5.19之前的内核不认识IORING_ACCEPT_MULTISHOT，之后的监听socket都用POLL_ADD
+      LOG << "io_uring multishot accept is not supported, use poll";
+      acceptMultishot_ = false;
+      mode_[fd] = MODE_POLL;
+      rearm_.push_back(fd);
+      return;
+    }
+    // 出错(比如EMFILE)后内核终止了它，回调处理完错误再重新提交
+    rearm_.push_back(fd);
+  }
+  if (cqe.res == -ECANCELED) return;
+  accepted_[fd].push_back(cqe.res);
+  revents_[fd] |= EPOLLIN;
+}
+
+void IoUringPoller::handleRecv(int fd, const struct io_uring_cqe &cqe) {
+  const char *data = NULL;
+  uint16_t bid = 0;
+  if (cqe.flags & IORING_CQE_F_BUFFER) {
+    bid = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+    data = recvBuffers_ + bid * kRecvBufferSize;
+  }
+  if (static_cast<uint32_t>(cqe.user_data >> 32) == opGeneration_[fd]) {
+    opArmed_[fd] = false;
+    const std::shared_ptr<HttpData> &conn = fd2http_[fd];
+    if (cqe.res == -ENOBUFS) {
+      // 这一批里缓冲区被用完了，数据还在socket里，缓冲区还回来以后再收
+      rearm_.push_back(fd);
+    } else if (cqe.res != -ECANCELED && conn) {
+      if (cqe.res > 0) {
+        conn->received(data, static_cast<size_t>(cqe.res));
+      } else {
+        conn->receiveFailed(-cqe.res);
+        mode_[fd] = MODE_RECV_DONE;
+      }
+      revents_[fd] |= EPOLLIN;
+    }
+  }
+  // 作废的完成事件也可能占着缓冲区
+  if (data) recycleBuffer(bid);
+}
+
+std::vector<SP_Channel> IoUringPoller::poll() {
+  std::vector<SP_Channel> req_data;
+  std::vector<int> ready;
+  while (true) {
+    // 提交这一轮积攒的请求，同时等待至少一个完成事件
+    int waitTime = timerManager_.nextTimeout(POLLWAIT_TIME);
+    struct __kernel_timespec ts;
+    ts.tv_sec = waitTime / 1000;
+    ts.tv_nsec = (waitTime % 1000) * 1000000L;
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof arg);
+    arg.ts = reinterpret_cast<uint64_t>(&ts);
+    int ret = enter(toSubmit_, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                    &arg, sizeof arg);
+    const int err = ret < 0 ? errno : 0;
+    if (ret < 0 && err != ETIME && err != EBUSY)
+      perror("io_uring_enter error");
+    if (ret >= 0) toSubmit_ = 0;
+
+    unsigned head = *cqHead_;
+    unsigned tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+      const struct io_uring_cqe &cqe = cqes_[head & cqMask_];
+      if (cqe.user_data == kIgnoredUserData) continue;
+      int fd = static_cast<int>(cqe.user_data & 0xffffff);
+      Op op = static_cast<Op>((cqe.user_data >> 24) & 0xff);
+      bool wasReady = revents_[fd] != 0;
+      if (op == OP_RECV) {
+        handleRecv(fd, cqe);
+      } else if (op == OP_ACCEPT) {
+        handleAccept(fd, cqe);
+      } else if (op == OP_SEND) {
+        handleSend(fd, cqe);
+      } else if (static_cast<uint32_t>(cqe.user_data >> 32) == generation_[fd]) {
+        if (!(cqe.flags & IORING_CQE_F_MORE)) {
+          // multishot被内核终止了(比如内存不够)，channel还在的话要重新注册
+          uint32_t events = armedEvents_[fd];
+          armedEvents_[fd] = 0;
+          if (fd2chan_[fd] && events != 0) rearm_.push_back(fd);
+        }
+        if (cqe.res > 0) revents_[fd] |= static_cast<uint32_t>(cqe.res);
+      }
+      if (!wasReady && revents_[fd] != 0) ready.push_back(fd);
+    }
+    __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+
+    // 同一个fd的RECV和POLL可能在同一批里完成，事件合在一起只交给channel一次
+    for (size_t i = 0; i < ready.size(); ++i) {
+      fillActiveChannel(ready[i], revents_[ready[i]], req_data);
+      revents_[ready[i]] = 0;
+    }
+    ready.clear();
+    for (size_t i = 0; i < rearm_.size(); ++i) {
+      int fd = rearm_[i];
+      if (fd2chan_[fd]) arm(fd, fd2chan_[fd]->getLastEvents());
+    }
+    rearm_.clear();
+    if (req_data.size() > 0) return req_data;
+    if (err == ETIME && waitTime < POLLWAIT_TIME) return req_data;
+  }
+}
@@ -0,0 +1,122 @@
+// @Author Wang Xin
+
+#pragma once
+#include <linux/io_uring.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <deque>
+#include <map>
+#include <vector>
+#include "Poller.h"
+
+/*
+用io_uring代替epoll_wait/epoll_ctl，不依赖liburing，直接用系统调用操作SQ/CQ两个环。按channel的类型分三种做法：
+  监听socket(Channel::isListening)：一个multishot的IORING_OP_ACCEPT，连接由内核直接收下，
+    放在accepted_里，回调通过acceptConn取走，不再需要就绪通知和accept系统调用；
+  不是TLS的HTTP连接：读由IORING_OP_RECV从provided buffer(IORING_OP_PROVIDE_BUFFERS交给内核的一组缓冲区)
+    里选一个完成，poller把数据追加进HttpData的inBuffer_再调用回调，handleRead不再自己读socket，缓冲区马上还回去；
+    每次只有一个RECV在途，回调不再要EPOLLIN(比如请求体的背压)时就不再提交，收到的数据有上限；
+    响应的内存段由submitSend做成IORING_OP_SENDMSG，和其他请求在同一次io_uring_enter里提交，socket写不进去时
+    内核自己等，完成后以EPOLLOUT回调。每个连接只有一个SENDMSG在途，数据保留到完成为止，文件段仍由回调sendfile；
+  其他channel以及连接上的EPOLLOUT：multishot的IORING_OP_POLL_ADD(带上channel的事件掩码，EPOLLET照样生效)，
+    事件掩码不变时一直有效，掩码变化、删除channel时提交POLL_REMOVE。
+所有新请求和等待事件合并在同一次io_uring_enter中提交，一轮循环里所有的注册改动只需要一次系统调用。
+回调看到的语义和Epoll一样：poll返回的channel设好了revents_，events_清零，由回调重新设置后再调用modChannel。
+内核不支持multishot accept(5.19之前)或者provided buffer时，对应的channel退回POLL_ADD
+*/
+class IoUringPoller : public Poller {
+ public:
+  // 内核不支持时返回NULL
+  static IoUringPoller *create();
+  ~IoUringPoller();
+  void addChannel(SP_Channel request, int timeout);
+  void modChannel(SP_Channel request, int timeout);
+  void delChannel(SP_Channel request);
+  std::vector<SP_Channel> poll();
+  int acceptConn(int listenFd, struct sockaddr *addr, socklen_t *addrLen);
+  bool submitSend(int fd, OutputQueue &queue);
+  const char *name() const { return "io_uring"; }
+
+ private:
+  static const unsigned kEntries = 1024;
+  static const uint64_t kIgnoredUserData = ~0ULL;// POLL_REMOVE/ASYNC_CANCEL自己的完成事件不用处理
+  // provided buffer：一个loop里同一批完成的RECV最多用这么多个缓冲区，拷进inBuffer_后马上归还
+  static const unsigned kRecvBuffers = 256;
+  static const unsigned kRecvBufferSize = 16 * 1024;
+  static const uint16_t kBufferGroup = 0;
+
+  // 请求的种类放在user_data里
+  enum Op { OP_POLL = 0, OP_ACCEPT, OP_RECV, OP_SEND };
+  // fd怎么等待可读
+  enum Mode {
+    MODE_POLL = 0,
+    MODE_ACCEPT,
+    MODE_RECV,
+    MODE_RECV_DONE// 对端已经关闭或者出错，不再提交RECV
+  };
+
+  int ringFd_;
+  void *sqRing_;
+  size_t sqRingSize_;
+  void *cqRing_;
+  size_t cqRingSize_;
+  struct io_uring_sqe *sqes_;
+  size_t sqesSize_;
+  unsigned *sqHead_;
+  unsigned *sqTail_;
+  unsigned sqMask_;
+  unsigned sqEntries_;
+  unsigned *sqArray_;
+  unsigned *cqHead_;
+  unsigned *cqTail_;
+  unsigned cqMask_;
+  struct io_uring_cqe *cqes_;
+  unsigned toSubmit_;// 已经放进SQ还没提交的请求数
+
+  char *recvBuffers_;// 内核不支持provided buffer时为NULL，连接都用POLL_ADD
+  bool acceptMultishot_;// 第一次提交时内核回EINVAL就说明不支持，之后都退回POLL_ADD
+
+  /*
+  user_data = (generation << 32) | (op << 24) | fd：fd被关闭复用后，旧请求的完成事件靠generation识别出来丢掉。
+  POLL_ADD每次掩码变化都换generation；ACCEPT、RECV和SENDMSG的generation只在channel加入和删除时换，
+  掩码变化不取消它们，已经收下的连接和数据不会丢
+  */
+  uint32_t generation_[MAXFDS];
+  uint32_t opGeneration_[MAXFDS];
+  uint32_t armedEvents_[MAXFDS];// 当前生效的poll请求的事件掩码，0表示没有
+  uint8_t mode_[MAXFDS];
+  bool opArmed_[MAXFDS];// ACCEPT或者RECV还在途
+  uint32_t revents_[MAXFDS];// 这一批完成事件里各个fd累计的事件，同一个fd只返回一次
+  std::vector<int> rearm_;// 请求被内核终止的fd，处理完事件后重新注册
+  std::map<int, std::deque<int> > accepted_;// 监听fd收下还没取走的连接，负数是-errno
+  // 在途的SENDMSG，msghdr和数据都要保留到完成事件回来，连接先关闭了也一样
+  struct PendingSend {
+    struct msghdr msg;
+    struct iovec iov[OutputQueue::kMaxIov];
+    OutputQueue::PinnedBuffers pinned;
+  };
+  std::map<uint64_t, PendingSend> sends_;// 按user_data
+  bool sendArmed_[MAXFDS];// 连接的SENDMSG还在途，EPOLLOUT由它的完成事件报告
+
+  IoUringPoller();
+  bool init();
+  bool initBuffers();
+  struct io_uring_sqe *getSqe();
+  int enter(unsigned toSubmit, unsigned minComplete, unsigned flags,
+            const void *arg, size_t argSize);
+  void arm(int fd, uint32_t events);
+  void armPoll(int fd, uint32_t events);
+  void cancelPoll(int fd);
+  void armAccept(int fd);
+  void armRecv(int fd);
+  void cancelOp(int fd);
+  void cancelSend(int fd);
+  void recycleBuffer(uint16_t bid);
+  void handleRecv(int fd, const struct io_uring_cqe &cqe);
+  void handleAccept(int fd, const struct io_uring_cqe &cqe);
+  void handleSend(int fd, const struct io_uring_cqe &cqe);
+  uint64_t userData(Op op, int fd, uint32_t generation) const {
+    return (static_cast<uint64_t>(generation) << 32) |
+           (static_cast<uint64_t>(op) << 24) | static_cast<uint64_t>(fd);
+  }
+};
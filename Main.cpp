@@ -1,20 +1,79 @@
 // @Author Wang Xin
 
 #include <getopt.h>
+#include <sched.h>
+#include <string.h>
 #include <string>
+#include <vector>
+#include "BodySink.h"
+#include "ContentCache.h"
 #include "EventLoop.h"
+#include "FileCache.h"
+#include "HttpData.h"
+#include "HttpParser.h"
+#include "OutputQueue.h"
+#include "Poller.h"
+#include "Proxy.h"
 #include "Server.h"
+#include "TlsConn.h"
+#include "base/CurrentThread.h"
 #include "base/Logging.h"
 
+// 解析"0-3,8,10"形式的CPU列表
+static std::vector<int> parseCpuList(const char *str) {
+  std::vector<int> cpus;
+  const char *p = str;
+  while (*p) {
+    char *end;
+    int first = static_cast<int>(strtol(p, &end, 10));
+    int last = first;
+    if (end == p) break;
+    p = end;
+    if (*p == '-') {
+      last = static_cast<int>(strtol(p + 1, &end, 10));
+      p = end;
+    }
+    // CPU_SET对超出cpu_set_t的编号没有检查，这里先挡掉
+    if (first < 0 || last < first || last >= CPU_SETSIZE) return std::vector<int>();
+    for (int cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+    if (*p == ',') ++p;
+  }
+  return cpus;
+}
 
 int main(int argc, char *argv[]) {
   int threadNum = 4;
   int port = 12345;
+  // -p/-6/-u可以重复出现，都没给时只监听IPv4的port
+  std::vector<ListenAddr> addrs;
   std::string logPath = "./WX-WebServer.log";
+  // -R: 每个EventLoop线程用SO_REUSEPORT各自监听端口并直接accept
+  // -q: listen的backlog，-D: TCP_DEFER_ACCEPT秒数，-F: TCP_FASTOPEN队列长度
+  ListenOptions listenOpts;
+  LoadBalancePolicy policy = LB_ROUND_ROBIN;// -L rr|lc|p2c
+  int maxConnsPerLoop = 0;// -c: 每个EventLoop的连接数上限，超出的连接回503
+  // -a 0-3,8: 依次绑定acceptor所在的主线程、各个EventLoop线程、日志线程，列表不够长时循环使用
+  std::vector<int> cpus;
+  // -C: 每个EventLoop的文件缓存条目数(0表示不缓存)，-T: 缓存的stat结果多少毫秒后重新校验，-I: 用inotify及时失效
+  int fileCacheEntries = 4096;
+  int fileCacheTtl = 5000;
+  bool fileCacheInotify = false;
+  int contentCacheMB = 64;// -M: 所有线程共享的热点文件响应缓存的总大小(MB)，0表示不缓存
+  PollerBackend backend = POLLER_EPOLL;// -P epoll|uring
+  // -x /api=127.0.0.1:8080: URI以/api开头的请求反向代理到上游，可以重复出现
+  // -s 443: 在这个IPv4端口上提供HTTPS，可以重复出现，需要-S证书链文件和-K私钥文件(PEM)
+  std::string certFile, keyFile;
+  long zeroCopyThreshold = 0;// -Z: 一次发送的内存数据不小于这么多字节时用MSG_ZEROCOPY，0表示不用
+  int maxPipelined = 16;// -b: 一次读事件里最多处理的流水线请求数
+  // -B: 收请求体时输出积压到这么多字节就暂停读，-U: 上传的请求体在内存里最多放多少字节，
+  // -W /var/tmp: 超过-U的请求体转到这个目录下的临时文件里，不给时回413
+  long bodyHighWater = 1024 * 1024;
+  long bodyMemoryLimit = 1024 * 1024;
+  std::string spillDir;
 
   // parse args
   int opt;
-  const char *str = "t:l:p:";
+  const char *str = "t:l:p:6:u:Rq:D:F:L:a:c:C:T:IM:P:x:s:S:K:Z:b:B:U:W:";
   while ((opt = getopt(argc, argv, str)) != -1) {
     switch (opt) {
       case 't': {
@@ -31,6 +90,122 @@ int main(int argc, char *argv[]) {
       }
       case 'p': {
         port = atoi(optarg);
+        addrs.push_back(ListenAddr(AF_INET, port));
+        break;
+      }
+      case '6': {
+        addrs.push_back(ListenAddr(AF_INET6, atoi(optarg)));
+        break;
+      }
+      case 'u': {
+        addrs.push_back(ListenAddr(std::string(optarg)));
+        break;
+      }
+      case 'R': {
+        listenOpts.reusePort = true;
+        break;
+      }
+      case 'q': {
+        listenOpts.backlog = atoi(optarg);
+        break;
+      }
+      case 'D': {
+        listenOpts.deferAccept = atoi(optarg);
+        break;
+      }
+      case 'F': {
+        listenOpts.fastOpen = atoi(optarg);
+        break;
+      }
+      case 'L': {
+        if (strcmp(optarg, "rr") == 0)
+          policy = LB_ROUND_ROBIN;
+        else if (strcmp(optarg, "lc") == 0)
+          policy = LB_LEAST_CONNECTIONS;
+        else if (strcmp(optarg, "p2c") == 0)
+          policy = LB_POWER_OF_TWO;
+        else {
+          printf("load balance policy should be rr, lc or p2c\n");
+          abort();
+        }
+        break;
+      }
+      case 'c': {
+        maxConnsPerLoop = atoi(optarg);
+        break;
+      }
+      case 'a': {
+        cpus = parseCpuList(optarg);
+        if (cpus.empty()) {
+          printf("cpu list should look like 0-3,8, cpu ids in [0, %d)\n", CPU_SETSIZE);
+          abort();
+        }
+        break;
+      }
+      case 'C': {
+        fileCacheEntries = atoi(optarg);
+        break;
+      }
+      case 'T': {
+        fileCacheTtl = atoi(optarg);
+        break;
+      }
+      case 'I': {
+        fileCacheInotify = true;
+        break;
+      }
+      case 'M': {
+        contentCacheMB = atoi(optarg);
+        break;
+      }
+      case 'P': {
+        if (strcmp(optarg, "epoll") == 0)
+          backend = POLLER_EPOLL;
+        else if (strcmp(optarg, "uring") == 0)
+          backend = POLLER_IO_URING;
+        else {
+          printf("poller should be epoll or uring\n");
+          abort();
+        }
+        break;
+      }
+      case 's': {
+        addrs.push_back(ListenAddr(AF_INET, atoi(optarg), true));
+        break;
+      }
+      case 'S': {
+        certFile = optarg;
+        break;
+      }
+      case 'K': {
+        keyFile = optarg;
+        break;
+      }
+      case 'Z': {
+        zeroCopyThreshold = atol(optarg);
+        break;
+      }
+      case 'b': {
+        maxPipelined = atoi(optarg);
+        break;
+      }
+      case 'B': {
+        bodyHighWater = atol(optarg);
+        break;
+      }
+      case 'U': {
+        bodyMemoryLimit = atol(optarg);
+        break;
+      }
+      case 'W': {
+        spillDir = optarg;
+        break;
+      }
+      case 'x': {
+        if (!ProxyRoutes::add(optarg)) {
+          printf("proxy route should look like /prefix=host:port\n");
+          abort();
+        }
         break;
       }
       default:
@@ -38,13 +213,46 @@ int main(int argc, char *argv[]) {
     }
   }
   Logger::setLogFileName(logPath);
+  for (size_t i = 0; i < addrs.size(); ++i) {
+    if (!addrs[i].tls) continue;
+    if (!TlsContext::init(certFile, keyFile.empty() ? certFile : keyFile)) {
+      printf("HTTPS needs a valid certificate (-S) and private key (-K)\n");
+      abort();
+    }
+    break;
+  }
+  FileCache::setOptions(fileCacheEntries < 0 ? 0 : fileCacheEntries,
+                        fileCacheTtl, fileCacheInotify);
+  Poller::setDefaultBackend(backend);
+  OutputQueue::setZeroCopyThreshold(
+      zeroCopyThreshold < 0 ? 0 : static_cast<size_t>(zeroCopyThreshold));
+  HttpData::setMaxPipelinedRequests(maxPipelined);
+  HttpData::setBodyHighWater(
+      bodyHighWater < 64 * 1024 ? 64 * 1024 : static_cast<size_t>(bodyHighWater));
+  SpillBuffer::setOptions(
+      bodyMemoryLimit < 0 ? 0 : static_cast<size_t>(bodyMemoryLimit), spillDir);
+  ContentCache::instance().setCapacity(
+      contentCacheMB < 0 ? 0 : static_cast<size_t>(contentCacheMB) << 20);
+  std::vector<int> loopCpus;
+  if (!cpus.empty()) {
+    for (int i = 1; i <= threadNum; ++i)
+      loopCpus.push_back(cpus[i % cpus.size()]);
+    Logger::setLogThreadCpu(cpus[(threadNum + 1) % cpus.size()]);
+    CurrentThread::bindToCpu(cpus[0]);
+  }
   LOG << "Hello, I'm Wangxin's logger, it's your first logline";
+  LOG << "header scanner: "
+      << HttpParser::scanImplName(HttpParser::scanImpl());
 // STL库在多线程上应用
 #ifndef _PTHREADS
   LOG << "_PTHREADS is not defined !";
 #endif
   EventLoop mainLoop;
-  Server myHTTPServer(&mainLoop, threadNum, port);
+  if (addrs.empty()) addrs.push_back(ListenAddr(AF_INET, port));
+  Server myHTTPServer(&mainLoop, threadNum, addrs, listenOpts);
+  myHTTPServer.setLoadBalancePolicy(policy);
+  myHTTPServer.setCpus(loopCpus);
+  myHTTPServer.setMaxConnsPerLoop(maxConnsPerLoop);
   myHTTPServer.start();
   mainLoop.loop();
   return 0;
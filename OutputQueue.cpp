@@ -0,0 +1,302 @@
+// @Author Wang Xin
+
+#include "OutputQueue.h"
+#include <errno.h>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <algorithm>
+#include <atomic>
+#include "base/Logging.h"
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+
+const int OutputQueue::kMaxIov;
+const size_t OutputQueue::kWriteChunk;
+size_t OutputQueue::zeroCopyThreshold_ = 0;
+
+static std::atomic<long> g_zeroCopySends(0);
+static std::atomic<long> g_zeroCopyCompletions(0);
+static std::atomic<long> g_zeroCopyCopied(0);
+
+void OutputQueue::zeroCopyStats(long &sends, long &completions, long &copied) {
+  sends = g_zeroCopySends.load(std::memory_order_relaxed);
+  completions = g_zeroCopyCompletions.load(std::memory_order_relaxed);
+  copied = g_zeroCopyCopied.load(std::memory_order_relaxed);
+}
+
+void OutputQueue::append(const char *data, size_t len) {
+  if (len == 0) return;
+  if (segments_.empty() || segments_.back().ptr || segments_.back().file) {
+    segments_.push_back(Segment());
+  }
+  Segment &back = segments_.back();
+  back.buf.append(data, len);
+  back.len += len;
+  bytes_ += len;
+}
+
+void OutputQueue::appendStatic(const void *data, size_t len) {
+  if (len == 0) return;
+  segments_.push_back(Segment());
+  segments_.back().ptr = static_cast<const char *>(data);
+  segments_.back().len = len;
+  bytes_ += len;
+}
+
+void OutputQueue::appendShared(const std::shared_ptr<const std::string> &str) {
+  if (str->empty()) return;
+  segments_.push_back(Segment());
+  segments_.back().shared = str;
+  segments_.back().ptr = str->data();
+  segments_.back().len = str->size();
+  bytes_ += str->size();
+}
+
+void OutputQueue::appendFile(const std::shared_ptr<FileHandle> &file,
+                             off_t offset, size_t len) {
+  if (len == 0) return;
+  segments_.push_back(Segment());
+  segments_.back().file = file;
+  segments_.back().offset = offset;
+  segments_.back().len = len;
+  bytes_ += len;
+}
+
+// 从队头去掉已经发出的n个字节，文件段的offset同样是往后移
+void OutputQueue::retrieve(size_t n) {
+  bytes_ -= n;
+  while (n > 0) {
+    Segment &front = segments_.front();
+    if (n < front.len) {
+      front.offset += n;
+      front.len -= n;
+      return;
+    }
+    n -= front.len;
+    segments_.pop_front();
+  }
+}
+
+ssize_t OutputQueue::flush(int fd) {
+  ssize_t writeSum = 0;
+  bool noZeroCopy = false;
+  while (!segments_.empty()) {
+    Segment &front = segments_.front();
+    if (front.file) {
+      ssize_t n = sendfile(fd, front.file->fd(), &front.offset, front.len);
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN) break;
+        return -1;
+      }
+      if (n == 0) {
+        // 文件在发送过程中被截短了，已经发出去的Content-Length再也凑不齐，只能断开连接
+        errno = EIO;
+        return -1;
+      }
+      front.len -= n;
+      bytes_ -= n;
+      writeSum += n;
+      if (front.len == 0) segments_.pop_front();
+      continue;
+    }
+
+    size_t runBytes = 0;
+    size_t i = 0;
+    for (; i < segments_.size() && static_cast<int>(i) < kMaxIov &&
+           !segments_[i].file;
+         ++i)
+      runBytes += segments_[i].len;
+    const bool zeroCopy = !noZeroCopy && useZeroCopy(fd, runBytes);
+    noZeroCopy = false;
+    struct iovec iov[kMaxIov];
+    int iovcnt = 0;
+    for (; iovcnt < static_cast<int>(i); ++iovcnt) {
+      Segment &seg = segments_[iovcnt];
+      // 拷贝段转成共享的，发送完成之前由zeroCopyPending_保留
+      if (zeroCopy) share(seg);
+      iov[iovcnt].iov_base = const_cast<char *>(seg.data());
+      iov[iovcnt].iov_len = seg.len;
+    }
+    struct msghdr msg;
+    memset(&msg, 0, sizeof msg);
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovcnt;
+    // 后面还有数据(通常是紧跟着的文件段)，让内核先攒着，和后面的数据凑成满的报文再发
+    int flags = MSG_NOSIGNAL;
+    if (i < segments_.size()) flags |= MSG_MORE;
+    if (zeroCopy) flags |= MSG_ZEROCOPY;
+    ssize_t n = sendmsg(fd, &msg, flags);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN) break;
+      if (zeroCopy && (errno == ENOBUFS || errno == EOPNOTSUPP)) {
+        // 超过了optmem限制，或者socket不支持(比如交给了内核TLS)，这次按普通方式发
+        if (errno == EOPNOTSUPP) zeroCopy_ = -1;
+        noZeroCopy = true;
+        continue;
+      }
+      return -1;
+    }
+    if (zeroCopy) pinSent(n);
+    retrieve(n);
+    writeSum += n;
+  }
+  return writeSum;
+}
+
+int OutputQueue::prepareSend(int fd, struct iovec *iov, int maxIov,
+                             PinnedBuffers &pinned, int &flags) {
+  size_t runBytes = 0;
+  size_t i = 0;
+  for (; i < segments_.size() && static_cast<int>(i) < maxIov &&
+         !segments_[i].file;
+       ++i)
+    runBytes += segments_[i].len;
+  // 零拷贝的完成通知要自己从错误队列里读，和异步发送混在一起序号就对不上了
+  if (i == 0 || useZeroCopy(fd, runBytes)) return 0;
+  for (size_t j = 0; j < i; ++j) {
+    Segment &seg = segments_[j];
+    share(seg);
+    if (seg.shared) pinned.push_back(seg.shared);
+    iov[j].iov_base = const_cast<char *>(seg.data());
+    iov[j].iov_len = seg.len;
+  }
+  flags = MSG_NOSIGNAL;
+  if (i < segments_.size()) flags |= MSG_MORE;
+  return static_cast<int>(i);
+}
+
+// 拷贝段的数据移到共享的string里，段本身出队之后数据还能由别人保留
+void OutputQueue::share(Segment &seg) {
+  if (seg.ptr) return;
+  seg.shared = std::make_shared<const std::string>(std::move(seg.buf));
+  seg.ptr = seg.shared->data();
+  seg.buf.clear();
+}
+
+bool OutputQueue::useZeroCopy(int fd, size_t runBytes) {
+  if (zeroCopyThreshold_ == 0 || zeroCopy_ < 0 || runBytes < zeroCopyThreshold_)
+    return false;
+  if (zeroCopy_ == 0) {
+    int one = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof one) < 0) {
+      zeroCopy_ = -1;
+      return false;
+    }
+    zeroCopy_ = 1;
+  }
+  return true;
+}
+
+// 刚用MSG_ZEROCOPY发出的n个字节所在的缓冲区，记在这次发送的序号下
+void OutputQueue::pinSent(size_t n) {
+  PinnedBuffers pinned;
+  for (size_t i = 0, covered = 0; covered < n; ++i) {
+    if (segments_[i].shared) pinned.push_back(segments_[i].shared);
+    covered += segments_[i].len;
+  }
+  zeroCopyPending_.push_back(std::make_pair(zeroCopySeq_++, std::move(pinned)));
+  ++g_zeroCopySends;
+}
+
+int OutputQueue::reapZeroCopy(int fd) {
+  int count = 0;
+  while (true) {
+    char control[128];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof msg);
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof control;
+    if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) break;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      if (!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) &&
+          !(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))
+        continue;
+      const struct sock_extended_err *serr =
+          reinterpret_cast<const struct sock_extended_err *>(CMSG_DATA(cmsg));
+      if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY || serr->ee_errno != 0)
+        continue;
+      // 一个通知覆盖序号[ee_info, ee_data]的若干次发送，TCP上按顺序完成
+      uint32_t hi = serr->ee_data;
+      long n = static_cast<long>(hi - serr->ee_info) + 1;
+      while (!zeroCopyPending_.empty() &&
+             static_cast<int32_t>(zeroCopyPending_.front().first - hi) <= 0)
+        zeroCopyPending_.pop_front();
+      ++count;
+      long total = g_zeroCopyCompletions.fetch_add(n) + n;
+      if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+        // 内核还是拷贝了(比如走loopback或者网卡不支持)，零拷贝只剩下额外开销，这个连接不再用
+        g_zeroCopyCopied += n;
+        zeroCopy_ = -1;
+      }
+      if ((total >> 12) != ((total - n) >> 12))
+        LOG << "MSG_ZEROCOPY: " << g_zeroCopySends.load() << " sends, " << total
+            << " completed, " << g_zeroCopyCopied.load()
+            << " fell back to copying";
+    }
+  }
+  return count;
+}
+
+OutputQueue::PinnedBuffers OutputQueue::takeZeroCopyPinned() {
+  PinnedBuffers pinned;
+  for (size_t i = 0; i < zeroCopyPending_.size(); ++i)
+    pinned.insert(pinned.end(), zeroCopyPending_[i].second.begin(),
+                  zeroCopyPending_[i].second.end());
+  zeroCopyPending_.clear();
+  return pinned;
+}
+
+ssize_t OutputQueue::flush(const WriteFunc &write) {
+  char chunk[kWriteChunk];
+  ssize_t writeSum = 0;
+  while (!segments_.empty()) {
+    const Segment &front = segments_.front();
+    const char *data = chunk;
+    size_t len = 0;
+    if (!front.file && front.len >= kWriteChunk) {
+      // 大块内存直接交出去，不用先拷贝一遍
+      data = front.data();
+      len = kWriteChunk;
+    } else {
+      // 小段凑成一整块，头部和body在同一个TLS记录里发出
+      for (size_t i = 0; i < segments_.size() && len < kWriteChunk; ++i) {
+        const Segment &seg = segments_[i];
+        size_t n = std::min(seg.len, kWriteChunk - len);
+        if (seg.file) {
+          ssize_t r = pread(seg.file->fd(), chunk + len, n, seg.offset);
+          if (r < 0) return -1;
+          if (r == 0) {
+            // 同sendfile，文件被截短了
+            errno = EIO;
+            return -1;
+          }
+          len += r;
+          if (static_cast<size_t>(r) < n) break;
+        } else {
+          memcpy(chunk + len, seg.data(), n);
+          len += n;
+        }
+      }
+    }
+    ssize_t n = write(data, len);
+    if (n < 0) {
+      if (errno == EAGAIN) break;
+      return -1;
+    }
+    retrieve(n);
+    writeSum += n;
+  }
+  return writeSum;
+}
@@ -0,0 +1,117 @@
+// @Author Wang Xin
+
+#pragma once
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// 打开的文件，最后一个引用释放时关闭fd。同一个文件可以同时挂在多个连接的输出队列上
+class FileHandle {
+ public:
+  explicit FileHandle(int fd) : fd_(fd) {}
+  ~FileHandle() {
+    if (fd_ >= 0) close(fd_);
+  }
+  int fd() const { return fd_; }
+
+ private:
+  FileHandle(const FileHandle &);
+  FileHandle &operator=(const FileHandle &);
+  int fd_;
+};
+
+/*
+响应的输出队列，由若干段组成，按顺序发送：
+  拷贝段：append进来的头部等小块数据，相邻的拷贝段合并成一段
+  引用段：静态内存(favicon等)或共享的缓存内容，只记指针不拷贝
+  文件段：用sendfile从文件直接发到socket
+连续的内存段用一次sendmsg(相当于带flags的writev)发出，不必先拼成一整块；
+内存段后面紧跟文件段时带上MSG_MORE，头部和文件的第一块数据合在同一个TCP报文里发出。
+打开零拷贝后，一次发送的内存段总长不小于阈值时带上MSG_ZEROCOPY，内核直接引用这些内存，
+这些段的数据要一直保留到socket错误队列里报告发送完成为止
+*/
+class OutputQueue {
+ public:
+  typedef std::shared_ptr<const std::string> SharedData;
+  typedef std::vector<SharedData> PinnedBuffers;
+
+  OutputQueue() : bytes_(0), zeroCopy_(0), zeroCopySeq_(0) {}
+
+  void append(const char *data, size_t len);
+  void append(const std::string &str) { append(str.data(), str.size()); }
+  // data在发送完之前必须一直有效，用于程序里的静态数据
+  void appendStatic(const void *data, size_t len);
+  void appendShared(const std::shared_ptr<const std::string> &str);
+  void appendFile(const std::shared_ptr<FileHandle> &file, off_t offset,
+                  size_t len);
+
+  size_t readableBytes() const { return bytes_; }
+  bool empty() const { return segments_.empty(); }
+  void clear() {
+    segments_.clear();
+    bytes_ = 0;
+  }
+
+  // 写到EAGAIN或者队列为空为止，返回写出的字节数，出错返回-1
+  ssize_t flush(int fd);
+  // 不能直接写socket时(用户态TLS)用write发送，语义同write(2)，返回-1且errno为EAGAIN表示暂时写不了。
+  // 每次最多凑kWriteChunk字节交给write，文件段先pread出来；写不了时下次重试给出的是同样的数据
+  typedef std::function<ssize_t(const void *, size_t)> WriteFunc;
+  ssize_t flush(const WriteFunc &write);
+  static const size_t kWriteChunk = 16 * 1024;// TLS记录明文的最大长度
+
+  /*
+  交给poller异步发送(io_uring的SENDMSG)：队头连续的内存段填进iov，返回段数，flags是sendmsg要带的标志。
+  发送完成之前这些段的数据由pinned保留，拷贝段转成共享的，之后append的数据不再合并进去；
+  队头是文件段或者这次该用零拷贝时返回0，由调用者照常flush。完成后用sent取走发出的字节
+  */
+  int prepareSend(int fd, struct iovec *iov, int maxIov, PinnedBuffers &pinned,
+                  int &flags);
+  void sent(size_t n) { retrieve(n); }
+  static const int kMaxIov = 64;
+
+  // 还有零拷贝发送没收到完成通知
+  bool zeroCopyPending() const { return !zeroCopyPending_.empty(); }
+  // 读socket错误队列里的零拷贝完成通知，释放对应的缓冲区，返回读到的通知个数
+  int reapZeroCopy(int fd);
+  // 连接关闭时还没收到完成通知的缓冲区，交给调用者再保留一段时间
+  PinnedBuffers takeZeroCopyPinned();
+
+  // 一次发送的内存段不小于bytes时用MSG_ZEROCOPY，0表示不用。必须在EventLoop线程启动之前调用
+  static void setZeroCopyThreshold(size_t bytes) { zeroCopyThreshold_ = bytes; }
+  // 全局计数：零拷贝发送次数、收到完成通知的次数、其中内核退回拷贝的次数
+  static void zeroCopyStats(long &sends, long &completions, long &copied);
+
+ private:
+  struct Segment {
+    const char *ptr;// 引用段的数据，拷贝段为NULL，数据在buf中
+    std::string buf;
+    std::shared_ptr<const std::string> shared;
+    std::shared_ptr<FileHandle> file;
+    off_t offset;// 文件段为文件中的发送位置，内存段为已经发出的字节数
+    size_t len;// 剩下没发的字节数
+    Segment() : ptr(NULL), offset(0), len(0) {}
+    const char *data() const { return (ptr ? ptr : buf.data()) + offset; }
+  };
+
+  void retrieve(size_t n);
+  bool useZeroCopy(int fd, size_t runBytes);
+  static void share(Segment &seg);
+  void pinSent(size_t n);
+
+  std::deque<Segment> segments_;
+  size_t bytes_;
+  int zeroCopy_;// 0: 还没用过，1: 已经打开SO_ZEROCOPY，-1: 这个socket不支持或者内核总是退回拷贝
+  uint32_t zeroCopySeq_;// 下一次零拷贝发送的序号，和内核的计数一致
+  // 每次零拷贝发送的序号和它引用的缓冲区，按序号递增
+  std::deque<std::pair<uint32_t, PinnedBuffers>> zeroCopyPending_;
+
+  static size_t zeroCopyThreshold_;
+};
@@ -0,0 +1,48 @@
+// @Author Wang Xin
+
+#include "Poller.h"
+#include "Epoll.h"
+#include "IoUringPoller.h"
+#include "base/Logging.h"
+
+PollerBackend Poller::defaultBackend_ = POLLER_EPOLL;
+
+Poller *Poller::newDefaultPoller() {
+  if (defaultBackend_ == POLLER_IO_URING) {
+    Poller *poller = IoUringPoller::create();
+    if (poller) return poller;
+    LOG << "io_uring is not available, fall back to epoll";
+  }
+  return new Epoll();
+}
+
+void Poller::registerChannel(SP_Channel request, int timeout) {
+  int fd = request->getFd();
+  if (timeout > 0) {
+    add_timer(request, timeout);
+    fd2http_[fd] = request->getHolder();
+  }
+  fd2chan_[fd] = request;
+}
+
+void Poller::fillActiveChannel(int fd, uint32_t revents,
+                               std::vector<SP_Channel> &active) {
+  SP_Channel cur_req = fd2chan_[fd];
+  if (cur_req) {
+    cur_req->setRevents(revents);
+    cur_req->setEvents(0);
+    // 加入线程池之前将Timer和request分离
+    // cur_req->seperateTimer();
+    active.push_back(cur_req);
+  } else {
+    LOG << "SP cur_req is invalid";
+  }
+}
+
+void Poller::add_timer(SP_Channel request_data, int timeout) {
+  std::shared_ptr<HttpData> t = request_data->getHolder();
+  if (t)
+    timerManager_.addTimer(t, timeout);
+  else
+    LOG << "timer add fail";
+}
@@ -0,0 +1,70 @@
+// @Author Wang Xin
+
+#pragma once
+#include <stdint.h>
+#include <sys/socket.h>
+#include <memory>
+#include <vector>
+#include "Channel.h"
+#include "HttpData.h"
+#include "Timer.h"
+#include "base/noncopyable.h"
+
+enum PollerBackend { POLLER_EPOLL = 0, POLLER_IO_URING };
+
+/*
+EventLoop使用的IO多路复用接口，具体实现有Epoll和IoUringPoller，启动时选定。
+不管哪种实现，channel的语义都一样：注册的是EPOLLIN/EPOLLOUT/EPOLLET等epoll的事件掩码，
+poll()返回的channel已经设好revents_，并把events_清零，由回调重新设置后再调用modChannel。
+监听socket的回调用acceptConn收连接，后端可以预先替它收好(见IoUringPoller)；连接的响应也可以交给后端发送(submitSend)。
+fd到channel的映射和超时定时器与实现无关，放在基类里
+*/
+class Poller : noncopyable {
+ public:
+  virtual ~Poller() {}
+  virtual void addChannel(SP_Channel request, int timeout) = 0;
+  virtual void modChannel(SP_Channel request, int timeout) = 0;
+  virtual void delChannel(SP_Channel request) = 0;
+  // 阻塞到有就绪事件或者最早的定时器到期为止，后一种情况返回空
+  virtual std::vector<SP_Channel> poll() = 0;
+  // 从监听socket收下一个连接，用法和accept(2)一样；后端自己收连接时(io_uring)从它那里取
+  virtual int acceptConn(int listenFd, struct sockaddr *addr,
+                         socklen_t *addrLen) {
+    return ::accept(listenFd, addr, addrLen);
+  }
+  // 把queue队头的数据交给后端异步发送(io_uring)，完成时由HttpData::sent取走并报告EPOLLOUT。
+  // 返回false表示后端不支持或者这些数据不适合异步发，由调用者自己写socket
+  virtual bool submitSend(int fd, OutputQueue &queue) { return false; }
+  virtual const char *name() const = 0;
+
+  void add_timer(SP_Channel request_data, int timeout);
+  void handleExpired() { timerManager_.handleExpiredEvent(); }
+  std::shared_ptr<TimerNode> runAfter(std::function<void()> cb, int timeout) {
+    return timerManager_.addTimer(std::move(cb), timeout);
+  }
+
+  // 对之后创建的EventLoop生效，必须在EventLoop线程启动之前调用
+  static void setDefaultBackend(PollerBackend backend) { defaultBackend_ = backend; }
+  // 按选定的后端创建，io_uring不可用(内核太老或被禁用)时退回epoll
+  static Poller *newDefaultPoller();
+
+ protected:
+  static const int MAXFDS = 100000;
+  std::shared_ptr<Channel> fd2chan_[MAXFDS];
+  std::shared_ptr<HttpData> fd2http_[MAXFDS];
+  TimerManager timerManager_;
+  // 每个EventLoop都有一个TimerManager，里面包含了一个时间节点的小顶堆。
+
+  // 记下fd对应的channel，timeout大于0时同时加上定时器
+  void registerChannel(SP_Channel request, int timeout);
+  void unregisterChannel(int fd) {
+    fd2chan_[fd].reset();
+    fd2http_[fd].reset();
+  }
+  // fd上有事件就绪，把对应的channel加入active
+  void fillActiveChannel(int fd, uint32_t revents,
+                         std::vector<SP_Channel> &active);
+
+ private:
+  static PollerBackend defaultBackend_;
+};
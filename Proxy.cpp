@@ -0,0 +1,572 @@
+// @Author Wang Xin
+
+#include "Proxy.h"
+#include <errno.h>
+#include <netdb.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <algorithm>
+#include <functional>
+#include "Channel.h"
+#include "EventLoop.h"
+#include "HttpData.h"
+#include "Timer.h"
+#include "Util.h"
+#include "base/Logging.h"
+
+using namespace std;
+
+std::vector<ProxyRoute> ProxyRoutes::routes_;
+
+const int UpstreamConn::kConnectTimeout;
+const int UpstreamConn::kReadTimeout;
+const int UpstreamConn::kIdleTimeout;
+const size_t UpstreamConn::kHighWaterMark;
+const size_t UpstreamConn::kMaxHeaderSize;
+const size_t UpstreamPool::kMaxIdlePerRoute;
+
+bool ProxyRoutes::add(const string &spec) {
+  size_t eq = spec.find('=');
+  size_t colon = spec.rfind(':');
+  if (spec.empty() || spec[0] != '/' || eq == string::npos ||
+      colon == string::npos || colon < eq)
+    return false;
+  ProxyRoute route;
+  route.prefix = spec.substr(0, eq);
+  // 前缀末尾的'/'去掉，"/api/"和"/api"是同一条规则
+  while (route.prefix.size() > 1 && route.prefix[route.prefix.size() - 1] == '/')
+    route.prefix.erase(route.prefix.size() - 1);
+  route.host = spec.substr(eq + 1, colon - eq - 1);
+  // IPv6地址写成[::1]:8080
+  if (route.host.size() > 2 && route.host[0] == '[' &&
+      route.host[route.host.size() - 1] == ']')
+    route.host = route.host.substr(1, route.host.size() - 2);
+  route.port = atoi(spec.c_str() + colon + 1);
+  if (route.host.empty() || route.port <= 0 || route.port > 65535) return false;
+
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof hints);
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo *result = NULL;
+  string service = to_string(route.port);
+  if (getaddrinfo(route.host.c_str(), service.c_str(), &hints, &result) != 0 ||
+      result == NULL)
+    return false;
+  memcpy(&route.addr, result->ai_addr, result->ai_addrlen);
+  route.addrLen = result->ai_addrlen;
+  freeaddrinfo(result);
+  routes_.push_back(route);
+  return true;
+}
+
+const ProxyRoute *ProxyRoutes::match(const string &uri) {
+  const ProxyRoute *best = NULL;
+  for (size_t i = 0; i < routes_.size(); ++i) {
+    const string &prefix = routes_[i].prefix;
+    if (uri.compare(0, prefix.size(), prefix) != 0) continue;
+    // "/api"匹配"/api"、"/api/x"和"/api?x"，不匹配"/apix"
+    if (prefix.size() > 1 && uri.size() > prefix.size() &&
+        uri[prefix.size()] != '/' && uri[prefix.size()] != '?')
+      continue;
+    if (best == NULL || prefix.size() > best->prefix.size()) best = &routes_[i];
+  }
+  return best;
+}
+
+UpstreamConn::UpstreamConn(EventLoop *loop, UpstreamPool *pool,
+                           const ProxyRoute *route)
+    : loop_(loop),
+      pool_(pool),
+      route_(route),
+      fd_(-1),
+      state_(kClosed),
+      reused_(false),
+      paused_(false),
+      writeScheduled_(false),
+      readScheduled_(false),
+      headRequest_(false),
+      bodySent_(0),
+      headParsed_(false),
+      responseStarted_(false),
+      upstreamKeepAlive_(false),
+      framing_(kNoBody),
+      remaining_(0) {}
+
+UpstreamConn::~UpstreamConn() { cancelTimer(); }
+
+bool UpstreamConn::connect() {
+  int fd = socket(route_->addr.ss_family,
+                  SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    perror("upstream socket");
+    return false;
+  }
+  if (::connect(fd, (const struct sockaddr *)&route_->addr, route_->addrLen) <
+          0 &&
+      errno != EINPROGRESS) {
+    LOG << "Connect to upstream " << route_->host << ":" << route_->port
+        << " failed: " << strerror(errno);
+    close(fd);
+    return false;
+  }
+  if (route_->addr.ss_family != AF_UNIX) setSocketNodelay(fd);
+  fd_ = fd;
+  state_ = kConnecting;
+  /*
+  回调里绑定的是shared_ptr：channel还在poller里时连接对象不会被析构，
+  closeSocket()把channel从poller里拿掉、释放掉channel之后这个循环引用就断开了
+  */
+  shared_ptr<UpstreamConn> self(shared_from_this());
+  channel_.reset(new Channel(loop_, fd));
+  channel_->setReadHandler(bind(&UpstreamConn::handleRead, self));
+  channel_->setWriteHandler(bind(&UpstreamConn::handleWrite, self));
+  channel_->setErrorHandler(bind(&UpstreamConn::handleError, self));
+  channel_->setConnHandler(bind(&UpstreamConn::updateEvents, self));
+  channel_->setEvents(EPOLLIN | EPOLLOUT | EPOLLET);
+  loop_->addToPoller(channel_, 0);
+  armTimer(kConnectTimeout);
+  return true;
+}
+
+void UpstreamConn::closeSocket() {
+  if (channel_) {
+    loop_->removeFromPoller(channel_);
+    channel_.reset();// fd在channel析构时关闭
+  }
+  fd_ = -1;
+}
+
+void UpstreamConn::start(const shared_ptr<HttpData> &client,
+                         const string &head, bool headRequest) {
+  client_ = client;
+  requestHead_ = head;
+  headRequest_ = headRequest;
+  bodySent_ = 0;
+  paused_ = false;
+  headParsed_ = false;
+  responseStarted_ = false;
+  upstreamKeepAlive_ = false;
+  framing_ = kNoBody;
+  remaining_ = 0;
+  chunked_.reset();
+  inBuffer_.retrieveAll();
+  outBuffer_.append(head);
+  if (state_ == kIdle) {
+    state_ = kBusy;
+    armTimer(kReadTimeout);
+  }
+  scheduleWrite();
+}
+
+size_t UpstreamConn::sendBody(const char *data, size_t len) {
+  if (state_ == kClosed) return len;
+  outBuffer_.append(data, len);
+  bodySent_ += len;
+  scheduleWrite();
+  return len;
+}
+
+/*
+start()和sendBody()是在客户端连接的回调里调用的，发送放到本轮的pendingFunctors里去做：
+出错时要通知客户端(回502、关连接)，不能在客户端自己的回调中间进行；同一轮里多次调用也只发送一次
+*/
+void UpstreamConn::scheduleWrite() {
+  if (writeScheduled_ || state_ != kBusy) return;
+  writeScheduled_ = true;
+  loop_->queueInLoop(bind(&UpstreamConn::flushOutput, shared_from_this()));
+}
+
+void UpstreamConn::flushOutput() {
+  writeScheduled_ = false;
+  if (state_ != kBusy) return;
+  handleWrite();
+  updateEvents();
+}
+
+void UpstreamConn::resume() {
+  if (!paused_ || state_ != kBusy) return;
+  paused_ = false;
+  // 同样不能在客户端的回调中间读上游、往客户端写数据
+  scheduleRead();
+}
+
+// 上游socket里还有没读的数据，边沿触发不会再通知，放到这一轮事件处理之后接着读
+void UpstreamConn::scheduleRead() {
+  if (readScheduled_) return;
+  readScheduled_ = true;
+  loop_->queueInLoop(bind(&UpstreamConn::resumeRead, shared_from_this()));
+}
+
+void UpstreamConn::resumeRead() {
+  readScheduled_ = false;
+  if (state_ != kBusy) return;
+  handleRead();
+  updateEvents();
+}
+
+void UpstreamConn::abort() {
+  client_.reset();
+  cancelTimer();
+  closeSocket();
+  state_ = kClosed;
+}
+
+void UpstreamConn::setIdle() {
+  state_ = kIdle;
+  reused_ = true;
+  requestHead_.clear();
+  inBuffer_.retrieveAll();
+  outBuffer_.retrieveAll();
+  armTimer(kIdleTimeout);
+  updateEvents();
+}
+
+void UpstreamConn::updateEvents() {
+  if (state_ == kClosed || !channel_) return;
+  __uint32_t events = EPOLLIN | EPOLLET;
+  if (state_ == kConnecting || outBuffer_.readableBytes() > 0)
+    events |= EPOLLOUT;
+  channel_->setEvents(events);
+  loop_->updatePoller(channel_);
+}
+
+void UpstreamConn::armTimer(int timeout) {
+  cancelTimer();
+  timer_ = loop_->runAfter(
+      timeout, bind(&UpstreamConn::onTimeoutWeak,
+                    weak_ptr<UpstreamConn>(shared_from_this())));
+}
+
+void UpstreamConn::cancelTimer() {
+  shared_ptr<TimerNode> timer(timer_.lock());
+  if (timer) timer->clearReq();
+  timer_.reset();
+}
+
+// 定时器不能延长连接对象的生命周期，只持有weak_ptr
+void UpstreamConn::onTimeoutWeak(const weak_ptr<UpstreamConn> &conn) {
+  shared_ptr<UpstreamConn> guard(conn.lock());
+  if (guard) guard->onTimeout();
+}
+
+void UpstreamConn::onTimeout() {
+  timer_.reset();
+  if (state_ == kIdle) {
+    shared_ptr<UpstreamConn> guard(shared_from_this());
+    pool_->remove(this);
+    abort();
+  } else if (state_ == kConnecting) {
+    fail(504, "Gateway Timeout");
+  } else if (state_ == kBusy) {
+    // 暂停读上游是在等客户端，客户端自己的超时会处理它，这里接着等
+    if (paused_)
+      armTimer(kReadTimeout);
+    else
+      fail(504, "Gateway Timeout");
+  }
+}
+
+void UpstreamConn::handleError() {
+  if (!channel_) return;
+  shared_ptr<UpstreamConn> guard(shared_from_this());
+  int err = 0;
+  socklen_t len = sizeof err;
+  getsockopt(fd_, SOL_SOCKET, SO_ERROR, &err, &len);
+  if (state_ == kIdle) {
+    pool_->remove(this);
+    abort();
+  } else if (state_ != kClosed) {
+    LOG << "Upstream " << route_->host << ":" << route_->port
+        << " error: " << strerror(err);
+    if (state_ == kConnecting || !retry()) fail(502, "Bad Gateway");
+  }
+}
+
+void UpstreamConn::handleWrite() {
+  if (!channel_) return;
+  if (state_ == kConnecting) {
+    int err = 0;
+    socklen_t len = sizeof err;
+    if (getsockopt(fd_, SOL_SOCKET, SO_ERROR, &err, &len) < 0) err = errno;
+    if (err != 0) {
+      LOG << "Connect to upstream " << route_->host << ":" << route_->port
+          << " failed: " << strerror(err);
+      fail(502, "Bad Gateway");
+      return;
+    }
+    state_ = kBusy;
+    armTimer(kReadTimeout);
+  }
+  if (state_ != kBusy) return;
+  bool blocked = writeBlocked();
+  if (outBuffer_.readableBytes() > 0) {
+    ssize_t n = writen(fd_, outBuffer_);
+    if (n < 0) {
+      // 复用的连接可能在我们发请求时刚好被上游关掉，还没发过请求体的话换一条新连接重发
+      if (!retry()) fail(502, "Bad Gateway");
+      return;
+    }
+    // 上传大的请求体时上游还在收数据，读超时从最后一次发出数据开始算
+    if (n > 0) armTimer(kReadTimeout);
+  }
+  if (blocked && !writeBlocked()) {
+    shared_ptr<HttpData> client(client_.lock());
+    if (client)
+      loop_->queueInLoop(bind(&HttpData::resumeProxyBody, client));
+  }
+}
+
+void UpstreamConn::handleRead() {
+  if (!channel_ || state_ == kClosed || state_ == kConnecting) return;
+  shared_ptr<UpstreamConn> guard(shared_from_this());
+  if (state_ == kIdle) {
+    // 空闲连接上不应该有数据：要么上游关闭了连接，要么是多余的数据，这条连接都不能再用了
+    pool_->remove(this);
+    abort();
+    return;
+  }
+  shared_ptr<HttpData> client(client_.lock());
+  if (!client) {
+    abort();
+    return;
+  }
+  if (paused_) return;
+  if (client->pendingOutput() >= kHighWaterMark) {
+    // 客户端收得慢，数据先留在上游socket的接收缓冲区里，TCP的流量控制会让上游慢下来
+    paused_ = true;
+    return;
+  }
+  // 每次最多读kHighWaterMark字节，转给客户端以后再读，上游很快时也不会一次把socket读空、占住事件循环
+  bool zero = false;
+  ssize_t n = readn(fd_, inBuffer_, zero, kHighWaterMark);
+  if (n < 0) {
+    if (!headParsed_ && inBuffer_.readableBytes() == 0 && retry()) return;
+    fail(502, "Bad Gateway");
+    return;
+  }
+  if (!headParsed_ && !parseHead(client)) {
+    if (state_ != kBusy) return;
+    if (zero) {
+      if (inBuffer_.readableBytes() == 0 && retry()) return;
+      fail(502, "Bad Gateway");
+    }
+    return;
+  }
+  forwardBody(client);
+  if (state_ != kBusy) return;
+  if (zero) {
+    // 没有Content-Length也不是chunked的响应以上游关闭连接作为结束
+    if (framing_ == kUntilClose)
+      finish(false);
+    else
+      fail(502, "Bad Gateway");
+    return;
+  }
+  if (static_cast<size_t>(n) >= kHighWaterMark) scheduleRead();
+  armTimer(kReadTimeout);
+}
+
+// 解析上游的响应头，改写之后交给客户端。头部还没收全时返回false
+bool UpstreamConn::parseHead(const shared_ptr<HttpData> &client) {
+  static const char kCRLFCRLF[] = "\r\n\r\n";
+  while (true) {
+    const char *begin = inBuffer_.peek();
+    const char *end =
+        search(begin, inBuffer_.endRead(), kCRLFCRLF, kCRLFCRLF + 4);
+    if (end == inBuffer_.endRead()) {
+      if (inBuffer_.readableBytes() > kMaxHeaderSize)
+        fail(502, "Bad Gateway");
+      return false;
+    }
+    const char *lineEnd = inBuffer_.findCRLF(begin);
+    if (lineEnd - begin < 12 || strncmp(begin, "HTTP/1.", 7) != 0) {
+      fail(502, "Bad Gateway");
+      return false;
+    }
+    int status = atoi(begin + 9);
+    bool http11 = begin[7] == '1';
+    if (status >= 100 && status < 200) {
+      // 1xx是临时响应，我们不会发Expect或者Upgrade，直接丢掉，接着等最终的响应
+      inBuffer_.retrieveUntil(end + 4);
+      continue;
+    }
+
+    string head("HTTP/1.1");
+    head.append(begin + 8, lineEnd);
+    head += "\r\n";
+    bool keepAlive = http11;
+    bool chunked = false;
+    bool hasLength = false;
+    size_t length = 0;
+    const char *line = lineEnd + 2;
+    while (line < end + 2) {
+      const char *eol = inBuffer_.findCRLF(line);
+      const char *colon =
+          static_cast<const char *>(memchr(line, ':', eol - line));
+      if (colon == NULL) {
+        line = eol + 2;
+        continue;
+      }
+      size_t nameLen = colon - line;
+      const char *value = colon + 1;
+      while (value < eol && (*value == ' ' || *value == '\t')) ++value;
+      string v(value, eol);
+      if (nameLen == 10 && strncasecmp(line, "Connection", 10) == 0) {
+        if (strcasestr(v.c_str(), "close")) keepAlive = false;
+        if (strcasestr(v.c_str(), "keep-alive")) keepAlive = true;
+        line = eol + 2;
+        continue;
+      }
+      // 逐跳头部只对上游这一段连接有效，不转给客户端
+      if ((nameLen == 10 && strncasecmp(line, "Keep-Alive", 10) == 0) ||
+          (nameLen == 16 && strncasecmp(line, "Proxy-Connection", 16) == 0)) {
+        line = eol + 2;
+        continue;
+      }
+      if (nameLen == 17 && strncasecmp(line, "Transfer-Encoding", 17) == 0) {
+        if (strcasestr(v.c_str(), "chunked")) chunked = true;
+      } else if (nameLen == 14 &&
+                 strncasecmp(line, "Content-Length", 14) == 0) {
+        hasLength = true;
+        length = strtoull(v.c_str(), NULL, 10);
+      }
+      head.append(line, eol + 2);
+      line = eol + 2;
+    }
+    inBuffer_.retrieveUntil(end + 4);
+
+    if (headRequest_ || status == 204 || status == 304)
+      framing_ = kNoBody;
+    else if (chunked)
+      framing_ = kChunked;
+    else if (hasLength)
+      framing_ = kLength;
+    else
+      framing_ = kUntilClose;
+    remaining_ = length;
+    upstreamKeepAlive_ = keepAlive && framing_ != kUntilClose;
+    headParsed_ = true;
+    responseStarted_ = true;
+    requestHead_.clear();
+    client->appendProxyHead(head, framing_ == kUntilClose);
+    return true;
+  }
+}
+
+void UpstreamConn::forwardBody(const shared_ptr<HttpData> &client) {
+  size_t avail = inBuffer_.readableBytes();
+  size_t n = 0;
+  bool done = false;
+  switch (framing_) {
+    case kNoBody:
+      done = true;
+      break;
+    case kLength:
+      n = min(avail, remaining_);
+      remaining_ -= n;
+      done = remaining_ == 0;
+      break;
+    case kChunked:
+      n = chunked_.scan(inBuffer_.peek(), avail);
+      if (chunked_.error()) {
+        fail(502, "Bad Gateway");
+        return;
+      }
+      done = chunked_.done();
+      break;
+    case kUntilClose:
+      n = avail;
+      break;
+  }
+  client->proxyOutput(inBuffer_.peek(), n);
+  inBuffer_.retrieve(n);
+  // 客户端可能在写的时候出错关闭了，它会abort这条连接
+  if (state_ != kBusy) return;
+  if (done) finish(upstreamKeepAlive_ && inBuffer_.readableBytes() == 0);
+}
+
+void UpstreamConn::finish(bool keepAlive) {
+  shared_ptr<UpstreamConn> guard(shared_from_this());
+  shared_ptr<HttpData> client(client_.lock());
+  client_.reset();
+  bool keepClient = framing_ != kUntilClose;
+  if (keepAlive)
+    pool_->release(guard);
+  else
+    abort();
+  if (client) client->proxyDone(keepClient);
+}
+
+void UpstreamConn::fail(int status, const char *msg) {
+  shared_ptr<UpstreamConn> guard(shared_from_this());
+  shared_ptr<HttpData> client(client_.lock());
+  LOG << "Proxy to " << route_->host << ":" << route_->port << " failed: "
+      << msg;
+  abort();
+  // 响应头已经转给客户端了就没法再回错误页，只能断开客户端连接
+  if (client) client->proxyFailed(responseStarted_ ? 0 : status, msg);
+}
+
+// 只有复用的连接、还没收到响应、也没发过请求体时才能安全地重发
+bool UpstreamConn::retry() {
+  if (!reused_ || headParsed_ || bodySent_ > 0 || requestHead_.empty())
+    return false;
+  cancelTimer();
+  closeSocket();
+  reused_ = false;
+  inBuffer_.retrieveAll();
+  outBuffer_.retrieveAll();
+  outBuffer_.append(requestHead_);
+  // 当前可能还在旧channel的回调里，新连接等这一轮事件处理完再建
+  state_ = kConnecting;
+  loop_->queueInLoop(bind(&UpstreamConn::reconnect, shared_from_this()));
+  return true;
+}
+
+void UpstreamConn::reconnect() {
+  if (state_ != kConnecting || channel_) return;
+  LOG << "Reused upstream connection to " << route_->host << ":" << route_->port
+      << " was closed, retry on a new one";
+  if (!connect()) fail(502, "Bad Gateway");
+}
+
+UpstreamPool::~UpstreamPool() {
+  for (map<const ProxyRoute *, ConnList>::iterator it = idle_.begin();
+       it != idle_.end(); ++it)
+    for (size_t i = 0; i < it->second.size(); ++i) it->second[i]->abort();
+}
+
+shared_ptr<UpstreamConn> UpstreamPool::acquire(const ProxyRoute *route) {
+  ConnList &list = idle_[route];
+  // 后放回去的连接最近还在用，被上游因为空闲而关掉的可能性最小
+  if (!list.empty()) {
+    shared_ptr<UpstreamConn> conn(list.back());
+    list.pop_back();
+    return conn;
+  }
+  shared_ptr<UpstreamConn> conn(new UpstreamConn(loop_, this, route));
+  if (!conn->connect()) return shared_ptr<UpstreamConn>();
+  return conn;
+}
+
+void UpstreamPool::release(const shared_ptr<UpstreamConn> &conn) {
+  ConnList &list = idle_[conn->route()];
+  if (list.size() >= kMaxIdlePerRoute) {
+    conn->abort();
+    return;
+  }
+  conn->setIdle();
+  list.push_back(conn);
+}
+
+void UpstreamPool::remove(UpstreamConn *conn) {
+  ConnList &list = idle_[conn->route()];
+  for (size_t i = 0; i < list.size(); ++i) {
+    if (list[i].get() == conn) {
+      list.erase(list.begin() + i);
+      break;
+    }
+  }
+}
@@ -0,0 +1,148 @@
+// @Author Wang Xin
+
+#pragma once
+#include <sys/socket.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Buffer.h"
+#include "HttpChunked.h"
+#include "base/noncopyable.h"
+
+class EventLoop;
+class Channel;
+class HttpData;
+class TimerNode;
+class UpstreamPool;
+
+// 一条反向代理规则：URI以prefix开头的请求原样转发给host:port
+struct ProxyRoute {
+  std::string prefix;
+  std::string host;
+  int port;
+  struct sockaddr_storage addr;
+  socklen_t addrLen;
+};
+
+class ProxyRoutes {
+ public:
+  // spec形如"/api=127.0.0.1:8080"，host在启动时解析一次，失败返回false。必须在EventLoop线程启动之前调用
+  static bool add(const std::string &spec);
+  // 按最长前缀匹配，没有匹配的规则返回NULL
+  static const ProxyRoute *match(const std::string &uri);
+  static bool empty() { return routes_.empty(); }
+
+ private:
+  static std::vector<ProxyRoute> routes_;
+};
+
+/*
+到上游服务器的一条keep-alive连接，和转发请求的客户端连接在同一个EventLoop里，全程非阻塞：
+  connect -> 发出改写过的请求头和请求体 -> 解析响应头，改写后交给客户端 -> 按Content-Length/chunked/关闭连接
+  确定响应在哪结束，把响应体原样转给客户端 -> 响应结束后放回UpstreamPool复用
+连接、读响应、空闲都有超时，定时器挂在所属EventLoop的TimerManager上。
+客户端来不及收时(输出队列超过kHighWaterMark)暂停读上游，上游来不及收请求体时客户端那边也暂停读
+*/
+class UpstreamConn : noncopyable,
+                     public std::enable_shared_from_this<UpstreamConn> {
+ public:
+  static const int kConnectTimeout = 3000;// ms
+  static const int kReadTimeout = 30000;// ms，等待上游的下一段响应数据
+  static const int kIdleTimeout = 60000;// ms，在连接池里空闲的时间
+  static const size_t kHighWaterMark = 256 * 1024;
+  static const size_t kMaxHeaderSize = 64 * 1024;
+
+  UpstreamConn(EventLoop *loop, UpstreamPool *pool, const ProxyRoute *route);
+  ~UpstreamConn();
+
+  const ProxyRoute *route() const { return route_; }
+  // 发起非阻塞connect，立即失败时返回false
+  bool connect();
+  // 开始转发一个请求，head是改写过的请求行和头部，headRequest为true时响应没有body
+  void start(const std::shared_ptr<HttpData> &client, const std::string &head,
+             bool headRequest);
+  // 转发一段请求体，全部放进发送缓冲区，返回放进去的字节数
+  size_t sendBody(const char *data, size_t len);
+  // 发送缓冲区积压太多，客户端那边应该暂停读请求体
+  bool writeBlocked() const {
+    return outBuffer_.readableBytes() >= kHighWaterMark;
+  }
+  // 客户端的输出队列降下来了，继续读上游的响应
+  void resume();
+  // 客户端断开或者出错，直接关掉这条连接，不再通知客户端
+  void abort();
+  // 放回连接池：等待下一个请求，同时监听上游关闭连接
+  void setIdle();
+
+ private:
+  enum State { kConnecting, kIdle, kBusy, kClosed };
+  enum Framing { kNoBody, kLength, kChunked, kUntilClose };
+
+  EventLoop *loop_;
+  UpstreamPool *pool_;
+  const ProxyRoute *route_;
+  std::shared_ptr<Channel> channel_;
+  int fd_;
+  State state_;
+  bool reused_;// 从连接池里取出来的，上游可能已经关掉了它
+  bool paused_;// 客户端积压太多，暂停读上游
+  bool writeScheduled_;
+  bool readScheduled_;
+  std::weak_ptr<HttpData> client_;
+  std::weak_ptr<TimerNode> timer_;
+  Buffer inBuffer_;
+  Buffer outBuffer_;
+  std::string requestHead_;// 复用的连接被上游关掉时用来在新连接上重发，收到响应后清空
+  bool headRequest_;
+  size_t bodySent_;
+
+  // 响应的解析状态
+  bool headParsed_;
+  bool responseStarted_;// 响应头已经交给客户端
+  bool upstreamKeepAlive_;
+  Framing framing_;
+  size_t remaining_;// kLength时剩下的body字节数
+  // kChunked时只找出响应在哪结束，数据原样转发
+  ChunkedDecoder chunked_;
+
+  void handleRead();
+  void handleWrite();
+  void handleError();
+  void updateEvents();
+  void scheduleWrite();
+  void flushOutput();
+  void scheduleRead();
+  void resumeRead();
+  void armTimer(int timeout);
+  void cancelTimer();
+  void onTimeout();
+  static void onTimeoutWeak(const std::weak_ptr<UpstreamConn> &conn);
+
+  bool parseHead(const std::shared_ptr<HttpData> &client);
+  void forwardBody(const std::shared_ptr<HttpData> &client);
+  void finish(bool keepAlive);
+  void fail(int status, const char *msg);
+  bool retry();
+  void reconnect();
+  void closeSocket();
+};
+
+// 每个EventLoop一份的上游连接池，只在所属线程中访问，不加锁
+class UpstreamPool : noncopyable {
+ public:
+  static const size_t kMaxIdlePerRoute = 64;
+
+  explicit UpstreamPool(EventLoop *loop) : loop_(loop) {}
+  ~UpstreamPool();
+  // 优先复用空闲连接，没有就新建，新建失败返回空指针
+  std::shared_ptr<UpstreamConn> acquire(const ProxyRoute *route);
+  void release(const std::shared_ptr<UpstreamConn> &conn);
+  // 空闲连接被上游关闭或者超时了，从池里拿掉
+  void remove(UpstreamConn *conn);
+
+ private:
+  typedef std::vector<std::shared_ptr<UpstreamConn>> ConnList;
+  EventLoop *loop_;
+  std::map<const ProxyRoute *, ConnList> idle_;
+};
@@ -2,51 +2,185 @@
 
 #include "Server.h"
 #include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
 #include <functional>
+#include <utility>
 #include "Util.h"
 #include "base/Logging.h"
 
-Server::Server(EventLoop *loop, int threadNum, int port)
+// 过载时直接由acceptor写给客户端的响应，预先拼好，拒绝连接时不做任何字符串操作
+static const char SERVICE_UNAVAILABLE[] =
+    "HTTP/1.1 503 Service Unavailable\r\n"
+    "Retry-After: 1\r\n"
+    "Content-Length: 0\r\n"
+    "Connection: close\r\n"
+    "\r\n";
+
+// 拒绝连接时最多替客户端读掉这么多请求数据，不让acceptor在一个连接上耗太久
+static const size_t kShedDrainBytes = 64 * 1024;
+
+static ListenOptions reusePortOptions(bool reusePort) {
+  ListenOptions opts;
+  opts.reusePort = reusePort;
+  return opts;
+}
+
+Server::Server(EventLoop *loop, int threadNum, int port, bool reusePort)
+    : Server(loop, threadNum,
+             std::vector<ListenAddr>(1, ListenAddr(AF_INET, port)),
+             reusePortOptions(reusePort)) {}
+
+Server::Server(EventLoop *loop, int threadNum,
+               const std::vector<ListenAddr> &addrs, const ListenOptions &opts)
     : loop_(loop),
       threadNum_(threadNum),
       eventLoopThreadPool_(new EventLoopThreadPool(loop_, threadNum)),
       started_(false),
-      acceptChannel_(new Channel(loop_)),
-      port_(port),
-      listenFd_(socket_bind_listen(port_)) {
-  acceptChannel_->setFd(listenFd_);
+      addrs_(addrs),
+      opts_(opts),
+      maxConnsPerLoop_(0) {
   handle_for_sigpipe();
-  if (setSocketNonBlocking(listenFd_) < 0) {
+  for (size_t i = 0; i < addrs_.size(); ++i) {
+    // SO_REUSEPORT模式下TCP的监听socket要等EventLoop都跑起来之后，在start()中逐个创建；
+    // AF_UNIX不支持SO_REUSEPORT分流，仍然只在baseLoop上监听一次
+    if (opts_.reusePort && addrs_[i].family != AF_UNIX) continue;
+    addAcceptor(addrs_[i], loop_, false);
+  }
+}
+
+void Server::addAcceptor(const ListenAddr &addr, EventLoop *loop,
+                         bool ownsConns) {
+  ListenOptions opts = opts_;
+  opts.reusePort = ownsConns;
+  int fd = socket_bind_listen(addr, opts);
+  if (fd < 0) {
+    perror("listen failed");
+    abort();
+  }
+  if (setSocketNonBlocking(fd) < 0) {
     perror("set socket non block failed");
     abort();
   }
+  int idleFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+  acceptors_.push_back(Acceptor(addr, loop, ownsConns, fd, idleFd));
+}
+
+// 选出还没到连接数上限的EventLoop，都满了返回NULL
+EventLoop *Server::pickLoop(Acceptor &acceptor) {
+  if (acceptor.ownsConns) {
+    if (maxConnsPerLoop_ > 0 &&
+        acceptor.loop->connections() >= maxConnsPerLoop_)
+      return NULL;
+    return acceptor.loop;
+  }
+  EventLoop *loop = eventLoopThreadPool_->getNextLoop();
+  if (maxConnsPerLoop_ <= 0) return loop;
+  for (int i = 0; i < threadNum_ && loop->connections() >= maxConnsPerLoop_;
+       ++i)
+    loop = eventLoopThreadPool_->getNextLoop();
+  return loop->connections() >= maxConnsPerLoop_ ? NULL : loop;
+}
+
+// 给客户端回一个503再关闭，而不是悄无声息地close，客户端可以按Retry-After重试
+void Server::shed(int fd, std::atomic<long> &counter) {
+  send(fd, SERVICE_UNAVAILABLE, sizeof(SERVICE_UNAVAILABLE) - 1,
+       MSG_DONTWAIT | MSG_NOSIGNAL);
+  // 接收缓冲区里还有没读的请求时close会回RST，客户端可能还没读到503就被丢掉了：
+  // 先发FIN，再把已经到达的请求读掉(不阻塞，最多读kShedDrainBytes)，然后再关闭
+  shutdown(fd, SHUT_WR);
+  char discard[4096];
+  for (size_t drained = 0; drained < kShedDrainBytes;) {
+    ssize_t n = recv(fd, discard, sizeof discard, MSG_DONTWAIT);
+    if (n <= 0) break;
+    drained += n;
+  }
+  close(fd);
+  ++counter;
+  long total = shedStats_.total();
+  if ((total & 1023) == 1)
+    LOG << "Overloaded, shed " << total << " connections (fd limit "
+        << shedStats_.fdLimit.load() << ", loop cap "
+        << shedStats_.loopCap.load() << ", no fd " << shedStats_.noFd.load()
+        << ")";
 }
 
 void Server::start() {
   eventLoopThreadPool_->start();
-  // acceptChannel_->setEvents(EPOLLIN | EPOLLET | EPOLLONESHOT);
-  acceptChannel_->setEvents(EPOLLIN | EPOLLET);
-  acceptChannel_->setReadHandler(bind(&Server::handNewConn, this));//handNewConn是Server类的成员函数，不能直接将其赋给一个回调函数（函数指针实现），因为类的成员函数中默认带有“this”参数，而回调函数的形式为void()，故赋给函数指针时，编译器会报错，故需先绑定“this”参数
-  acceptChannel_->setConnHandler(bind(&Server::handThisConn, this));
-  loop_->addToPoller(acceptChannel_, 0);
+  if (opts_.reusePort) {
+    std::vector<EventLoop *> loops = eventLoopThreadPool_->getAllLoops();
+    for (size_t i = 0; i < loops.size(); ++i)
+      for (size_t j = 0; j < addrs_.size(); ++j)
+        if (addrs_[j].family != AF_UNIX) addAcceptor(addrs_[j], loops[i], true);
+  }
+  // acceptors_创建完毕后才开始注册，之后其他EventLoop线程会并发地读acceptors_，不能再改动它
+  for (size_t i = 0; i < acceptors_.size(); ++i) {
+    Acceptor &acceptor = acceptors_[i];
+    // acceptor.channel->setEvents(EPOLLIN | EPOLLET | EPOLLONESHOT);
+    acceptor.channel->setEvents(EPOLLIN | EPOLLET);
+    acceptor.channel->setReadHandler(bind(&Server::handNewConn, this, i));//handNewConn是Server类的成员函数，不能直接将其赋给一个回调函数（函数指针实现），因为类的成员函数中默认带有“this”参数，而回调函数的形式为void()，故赋给函数指针时，编译器会报错，故需先绑定“this”参数
+    acceptor.channel->setConnHandler(bind(&Server::handThisConn, this, i));
+    acceptor.channel->setListening(true);
+    // epoll_add要在channel所属的EventLoop线程中执行
+    acceptor.loop->runInLoop(
+        bind(&EventLoop::addToPoller, acceptor.loop, acceptor.channel, 0));
+  }
   started_ = true;
 }
 
-void Server::handNewConn() {
-  struct sockaddr_in client_addr;
-  memset(&client_addr, 0, sizeof(struct sockaddr_in));
+// 每一个新的连接到来时，都要创建一个新的HttpData对象。
+// 在连接所属EventLoop的线程中创建，HttpData、Channel及其缓冲区都分配在该线程所在的NUMA节点上
+static void newConnection(EventLoop *loop, int fd, bool tls) {
+  shared_ptr<HttpData> req_info(new HttpData(loop, fd, tls));
+  req_info->getChannel()->setHolder(req_info);
+  req_info->newEvent();
+}
+
+// 一批连接在目标EventLoop线程中一次性注册到epoll，整批只占用一次pendingFunctors_加锁和一次wakeup
+static void newConnections(EventLoop *loop, std::vector<int> &fds, bool tls) {
+  for (size_t i = 0; i < fds.size(); ++i) newConnection(loop, fds[i], tls);
+  // 投递时预先计入的连接数已经由HttpData自己计入了
+  loop->addConnections(-static_cast<int>(fds.size()));
+}
+
+// ownsConns为false时由baseLoop accept，再用getNextLoop分发；否则连接归acceptor所在的EventLoop所有，
+// 运行在该EventLoop的线程中，不需要跨线程唤醒
+void Server::handNewConn(size_t idx) {
+  Acceptor &acceptor = acceptors_[idx];
+  int listenFd = acceptor.channel->getFd();
+  EventLoop *ownerLoop = acceptor.ownsConns ? acceptor.loop : NULL;
+  struct sockaddr_storage client_addr;
+  memset(&client_addr, 0, sizeof(client_addr));
   socklen_t client_addr_len = sizeof(client_addr);
   int accept_fd = 0;
-  while ((accept_fd = accept(listenFd_, (struct sockaddr *)&client_addr,
-                             &client_addr_len)) > 0) {
+  // 一次边沿触发中accept到的连接按目标EventLoop分组，drain结束后每个EventLoop只投递一次
+  std::vector<std::pair<EventLoop *, std::vector<int>>> batches;
+  while (true) {
     /*
-    因为在listenfd_上注册的事件是边沿触发的，所以一次要读取完所有的连接请求
+    因为在listenfd_上注册的事件是边沿触发的，所以一次要读取完所有的连接请求，
+    遇到EAGAIN之外的错误中途退出的话，监听socket会一直处于可读状态却再也收不到通知
     */
-    EventLoop *loop = eventLoopThreadPool_->getNextLoop();
-    LOG << "New connection from " << inet_ntoa(client_addr.sin_addr) << ":"
-        << ntohs(client_addr.sin_port);
+    client_addr_len = sizeof(client_addr);
+    // io_uring后端下连接已经由multishot accept收好了，这里只是取出来
+    accept_fd = acceptor.loop->acceptConn(
+        listenFd, (struct sockaddr *)&client_addr, &client_addr_len);
+    if (accept_fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      if ((errno == EMFILE || errno == ENFILE) && acceptor.idleFd >= 0) {
+        // fd用完了：让出预留的fd把这个连接接下来，回503后关掉，再把预留的fd占回来
+        close(acceptor.idleFd);
+        accept_fd = accept(listenFd, NULL, NULL);
+        if (accept_fd >= 0) shed(accept_fd, shedStats_.noFd);
+        acceptor.idleFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        if (accept_fd >= 0) continue;
+      }
+      break;
+    }
+    EventLoop *loop = pickLoop(acceptor);
+    LOG << "New connection from "
+        << sockaddrToString((struct sockaddr *)&client_addr);
     // cout << "new connection" << endl;
     // cout << inet_ntoa(client_addr.sin_addr) << endl;
     // cout << ntohs(client_addr.sin_port) << endl;
@@ -59,30 +193,54 @@ void Server::handNewConn() {
     */
     // 限制服务器的最大并发连接数
     if (accept_fd >= MAXFDS) {
-      close(accept_fd);
+      shed(accept_fd, shedStats_.fdLimit);
+      continue;
+    }
+    if (loop == NULL) {
+      shed(accept_fd, shedStats_.loopCap);
       continue;
     }
     // 设为非阻塞模式
     if (setSocketNonBlocking(accept_fd) < 0) {
       LOG << "Set non block failed!";
       // perror("Set non block failed!");
-      return;
+      close(accept_fd);
+      continue;
     }
 
-    setSocketNodelay(accept_fd);
+    if (acceptor.addr.family != AF_UNIX) setSocketNodelay(accept_fd);
     /*
     enable accept_fd的TCP_NODELAY选项，禁用Nagle算法，避免连续发包出现延迟
     */
     // setSocketNoLinger(accept_fd);
 
-    // 每一个新的连接到来时，都要创建一个新的HttpData对象
-    shared_ptr<HttpData> req_info(new HttpData(loop, accept_fd));
-    req_info->getChannel()->setHolder(req_info);
-    loop->queueInLoop(std::bind(&HttpData::newEvent, req_info));
-    /* 各个Loop对应的线程本可能阻塞在epoll_wait中，现在各个线程会立即从epoll_wait中被唤醒，在各个线程的epoller中加入监听这个accept_fd
+    if (ownerLoop) {
+      newConnection(loop, accept_fd, acceptor.addr.tls);
+      continue;
+    }
+    // HttpData要到目标线程里才创建，先把连接数记上，让同一批里后面的连接能看到这个EventLoop的负载
+    loop->addConnections(1);
+    size_t b = 0;
+    while (b < batches.size() && batches[b].first != loop) ++b;
+    if (b == batches.size())
+      batches.push_back(std::make_pair(loop, std::vector<int>()));
+    batches[b].second.push_back(accept_fd);
+    // 一批不宜过大，否则accept风暴期间worker线程要等很久才能拿到第一个连接
+    if (batches[b].second.size() >= MAX_BATCH) {
+      loop->queueInLoop(
+          std::bind(&newConnections, loop, std::move(batches[b].second),
+                    acceptor.addr.tls));
+      batches[b].second.clear();
+    }
+  }
+  for (size_t b = 0; b < batches.size(); ++b) {
+    if (batches[b].second.empty()) continue;
+    batches[b].first->queueInLoop(
+        std::bind(&newConnections, batches[b].first,
+                  std::move(batches[b].second), acceptor.addr.tls));
+    /* 各个Loop对应的线程本可能阻塞在epoll_wait中，现在各个线程会立即从epoll_wait中被唤醒，在各个线程的epoller中加入监听这批accept_fd
     实现了新的连接请求到来时对各个线程的异步唤醒
-    HttpData::newEvent中的this指针需要绑定req_info
     */
   }
-  acceptChannel_->setEvents(EPOLLIN | EPOLLET);//listenFd_上的连接请求已经读取完毕，需要在listenFd_上重新注册读就绪事件
+  acceptor.channel->setEvents(EPOLLIN | EPOLLET);//监听socket上的连接请求已经读取完毕，需要重新注册读就绪事件
 }
@@ -1,27 +1,76 @@
 // @Author Wang Xin
 
 #pragma once
+#include <netinet/in.h>
+#include <atomic>
 #include <memory>
+#include <vector>
 #include "Channel.h"
 #include "EventLoop.h"
 #include "EventLoopThreadPool.h"
+#include "Util.h"
+
+// 被拒绝(回503后关闭)的连接计数，各acceptor线程并发累加
+struct ShedStats {
+  std::atomic<long> fdLimit;// fd超过MAXFDS
+  std::atomic<long> loopCap;// 所有EventLoop的连接数都到了上限
+  std::atomic<long> noFd;// accept遇到EMFILE/ENFILE，靠预留的fd接下来再关闭
+  ShedStats() : fdLimit(0), loopCap(0), noFd(0) {}
+  long total() const { return fdLimit + loopCap + noFd; }
+};
 
 class Server {
  public:
-  Server(EventLoop *loop, int threadNum, int port);
+  Server(EventLoop *loop, int threadNum, int port, bool reusePort = false);
+  // 同时监听多个地址，所有监听socket accept到的连接都交给同一个EventLoopThreadPool
+  Server(EventLoop *loop, int threadNum, const std::vector<ListenAddr> &addrs,
+         const ListenOptions &opts = ListenOptions());
   ~Server() {}
   EventLoop *getLoop() const { return loop_; }
   void start();
-  void handNewConn();
-  void handThisConn() { loop_->updatePoller(acceptChannel_); }//如果这个acceptChannel_监听的事件或者监听的文件描述符改变了，要在loop_的poller中重新注册
+  void setLoadBalancePolicy(LoadBalancePolicy policy) {
+    eventLoopThreadPool_->setPolicy(policy);
+  }
+  void setCpus(const std::vector<int> &cpus) {
+    eventLoopThreadPool_->setCpus(cpus);
+  }
+  // 每个EventLoop最多同时处理的连接数，0表示不限制，必须在start()之前调用
+  void setMaxConnsPerLoop(int n) { maxConnsPerLoop_ = n; }
+  const ShedStats &shedStats() const { return shedStats_; }
 
  private:
+  // 一个监听socket，它的accept channel注册在loop上
+  struct Acceptor {
+    ListenAddr addr;
+    EventLoop *loop;
+    bool ownsConns;// 为true时accept到的连接直接留在loop上(SO_REUSEPORT模式)，否则用getNextLoop分发
+    std::shared_ptr<Channel> channel;
+    int idleFd;// 预留的空闲fd，fd耗尽时先关掉它，才能把连接accept下来再拒绝
+    Acceptor(const ListenAddr &a, EventLoop *l, bool owns, int fd, int idle)
+        : addr(a),
+          loop(l),
+          ownsConns(owns),
+          channel(new Channel(l, fd)),
+          idleFd(idle) {}
+  };
+
   EventLoop *loop_;
   int threadNum_;
   std::unique_ptr<EventLoopThreadPool> eventLoopThreadPool_;
   bool started_;
-  std::shared_ptr<Channel> acceptChannel_;
-  int port_;
-  int listenFd_;
+  std::vector<ListenAddr> addrs_;
+  ListenOptions opts_;// opts_.reusePort为true时，每个EventLoop都有自己的SO_REUSEPORT监听socket，由内核分配连接，不再经过baseLoop转交
+  std::vector<Acceptor> acceptors_;
+  int maxConnsPerLoop_;
+  ShedStats shedStats_;
   static const int MAXFDS = 100000;//限制并发连接数的原因是不让服务器过载或者不让操作系统的文件描述符资源耗尽
+  static const size_t MAX_BATCH = 64;// 一次交给同一个EventLoop的连接数上限
+
+  void addAcceptor(const ListenAddr &addr, EventLoop *loop, bool ownsConns);
+  void handNewConn(size_t idx);
+  EventLoop *pickLoop(Acceptor &acceptor);
+  void shed(int fd, std::atomic<long> &counter);
+  void handThisConn(size_t idx) {//如果这个acceptor监听的事件或者监听的文件描述符改变了，要在所属loop的poller中重新注册
+    acceptors_[idx].loop->updatePoller(acceptors_[idx].channel);
+  }
 };
@@ -14,12 +14,18 @@ TimerNode::TimerNode(std::shared_ptr<HttpData> requestData, int timeout)
       (((now.tv_sec % 10000) * 1000) + (now.tv_usec / 1000)) + timeout;
 }
 
+TimerNode::TimerNode(std::function<void()> callback, int timeout)
+    : deleted_(false), callback_(std::move(callback)) {
+  update(timeout);
+}
+
 TimerNode::~TimerNode() {// TimerNode被放在优先队列中，当从优先队列中被弹出时，TimerNode就会被析构
   if (SPHttpData) SPHttpData->handleClose();
+  else if (callback_) callback_();
 }
 
 TimerNode::TimerNode(TimerNode &tn)
-    : expiredTime_(0), SPHttpData(tn.SPHttpData) {}
+    : expiredTime_(0), SPHttpData(tn.SPHttpData), callback_(tn.callback_) {}
 
 void TimerNode::update(int timeout) {
   struct timeval now;
@@ -42,6 +48,7 @@ bool TimerNode::isValid() {
 
 void TimerNode::clearReq() {
   SPHttpData.reset();
+  callback_ = std::function<void()>();
   /*
   reset()包含两个操作。当智能指针中有值的时候，调用reset()会使引用计数减1.当调用reset（new xxx())重新赋值时，
   智能指针首先是生成新对象，然后将就旧对象的引用计数减1（当然，如果发现引用计数为0时，则析构旧对象），然后将新对象的指针交给智能指针保管。
@@ -61,6 +68,28 @@ void TimerManager::addTimer(std::shared_ptr<HttpData> SPHttpData, int timeout) {
   SPHttpData->linkTimer(new_node);
 }
 
+TimerManager::SPTimerNode TimerManager::addTimer(std::function<void()> callback,
+                                                 int timeout) {
+  SPTimerNode new_node(new TimerNode(std::move(callback), timeout));
+  timerNodeQueue.push(new_node);
+  return new_node;
+}
+
+// 用来计算poll的等待时间，让只有定时器、没有IO事件的EventLoop也能按时处理到期的定时器
+int TimerManager::nextTimeout(int maxWait) {
+  while (!timerNodeQueue.empty() && timerNodeQueue.top()->isDeleted())
+    timerNodeQueue.pop();
+  if (timerNodeQueue.empty()) return maxWait;
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  size_t temp = (((now.tv_sec % 10000) * 1000) + (now.tv_usec / 1000));
+  size_t expired = timerNodeQueue.top()->getExpTime();
+  if (expired <= temp) return 0;
+  return expired - temp < static_cast<size_t>(maxWait)
+             ? static_cast<int>(expired - temp)
+             : maxWait;
+}
+
 /* 处理逻辑是这样的~
 因为(1) 优先队列不支持随机访问
 (2) 即使支持，随机删除某节点后破坏了堆的结构，需要重新更新堆结构。
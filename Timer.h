@@ -3,6 +3,7 @@
 #pragma once
 #include <unistd.h>
 #include <deque>
+#include <functional>
 #include <memory>
 #include <queue>
 #include "HttpData.h"
@@ -15,6 +16,8 @@ class HttpData;
 class TimerNode {
  public:
   TimerNode(std::shared_ptr<HttpData> requestData, int timeout);
+  // 不和连接绑定的定时器，到期时执行callback，clearReq()之后就不再执行
+  TimerNode(std::function<void()> callback, int timeout);
   ~TimerNode();
   TimerNode(TimerNode &tn);
   void update(int timeout);
@@ -28,6 +31,7 @@ class TimerNode {
   bool deleted_;
   size_t expiredTime_;
   std::shared_ptr<HttpData> SPHttpData;
+  std::function<void()> callback_;
 };
 
 struct TimerCmp {
@@ -41,11 +45,15 @@ class TimerManager {
  public:
   TimerManager();
   ~TimerManager();
+  typedef std::shared_ptr<TimerNode> SPTimerNode;
   void addTimer(std::shared_ptr<HttpData> SPHttpData, int timeout);
+  // 返回的节点可以用clearReq()取消，调用方只应保存weak_ptr
+  SPTimerNode addTimer(std::function<void()> callback, int timeout);
   void handleExpiredEvent();
+  // 距离最早的定时器到期还有多少毫秒，没有定时器时返回maxWait，最多返回maxWait
+  int nextTimeout(int maxWait);
 
  private:
-  typedef std::shared_ptr<TimerNode> SPTimerNode;
   std::priority_queue<SPTimerNode, std::deque<SPTimerNode>, TimerCmp> timerNodeQueue;
   //注意这是优先队列，到期时间最短的时间结点被放在队列头，用优先队列实现小顶堆
 };
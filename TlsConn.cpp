@@ -0,0 +1,199 @@
+// @Author Wang Xin
+
+#include "TlsConn.h"
+#include <errno.h>
+#include <atomic>
+#include <functional>
+#include "Buffer.h"
+#include "OutputQueue.h"
+#include "base/Logging.h"
+
+SSL_CTX *TlsContext::ctx_ = NULL;
+
+#ifdef HAVE_OPENSSL
+#include <openssl/err.h>
+
+static const long kSessionCacheSize = 20480;
+static const long kSessionTimeout = 3600;// 秒
+static const size_t kReadChunk = 16 * 1024;// 一个TLS记录的最大明文长度
+
+static void logSslErrors(const char *what) {
+  unsigned long err;
+  while ((err = ERR_get_error()) != 0) {
+    char buf[256];
+    ERR_error_string_n(err, buf, sizeof buf);
+    LOG << what << ": " << buf;
+  }
+}
+
+bool TlsContext::init(const std::string &certFile, const std::string &keyFile) {
+  SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+  if (ctx == NULL) {
+    logSslErrors("SSL_CTX_new");
+    return false;
+  }
+  SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+  /*
+  SSL_OP_ENABLE_KTLS: 握手完成后由OpenSSL设置TCP_ULP "tls"并把密钥交给内核，
+  内核没有tls模块或者密码套件不支持时自动留在用户态加密。
+  对端不发close_notify直接断开当作正常关闭，不算错误
+  */
+  SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS | SSL_OP_NO_RENEGOTIATION |
+                               SSL_OP_CIPHER_SERVER_PREFERENCE |
+                               SSL_OP_IGNORE_UNEXPECTED_EOF);
+  // 内核TLS支持AES-GCM和CHACHA20-POLY1305，只用这几种
+  SSL_CTX_set_ciphersuites(ctx,
+                           "TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384:"
+                           "TLS_CHACHA20_POLY1305_SHA256");
+  SSL_CTX_set_cipher_list(ctx, "ECDHE+AESGCM:ECDHE+CHACHA20");
+  // 非阻塞写：写出一部分也返回；EAGAIN之后重试时数据可能在别的地址(输出队列凑块用的是栈上的缓冲区)
+  SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE |
+                            SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER |
+                            SSL_MODE_RELEASE_BUFFERS);
+  SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+  SSL_CTX_sess_set_cache_size(ctx, kSessionCacheSize);
+  SSL_CTX_set_timeout(ctx, kSessionTimeout);
+  static const unsigned char kSessionIdContext[] = "WangXinWebServer";
+  SSL_CTX_set_session_id_context(ctx, kSessionIdContext,
+                                 sizeof kSessionIdContext - 1);
+  // TLS 1.3默认握手后发两张票据，浏览器只会用一张
+  SSL_CTX_set_num_tickets(ctx, 1);
+  if (SSL_CTX_use_certificate_chain_file(ctx, certFile.c_str()) != 1 ||
+      SSL_CTX_use_PrivateKey_file(ctx, keyFile.c_str(), SSL_FILETYPE_PEM) !=
+          1 ||
+      SSL_CTX_check_private_key(ctx) != 1) {
+    logSslErrors("load certificate");
+    SSL_CTX_free(ctx);
+    return false;
+  }
+  ctx_ = ctx;
+  return true;
+}
+
+TlsConn::TlsConn(int fd)
+    : fd_(fd),
+      ssl_(SSL_new(TlsContext::get())),
+      established_(false),
+      ktlsSend_(false),
+      failed_(false) {
+  if (ssl_) {
+    SSL_set_fd(ssl_, fd);
+    SSL_set_accept_state(ssl_);
+  }
+}
+
+TlsConn::~TlsConn() {
+  if (ssl_ == NULL) return;
+  // 正常结束的连接要发close_notify，否则OpenSSL会把会话从缓存里删掉，客户端下次没法恢复
+  if (established_ && !failed_) SSL_shutdown(ssl_);
+  SSL_free(ssl_);
+}
+
+TlsConn::Result TlsConn::handshake() {
+  if (established_) return TLS_OK;
+  if (ssl_ == NULL || failed_) return TLS_ERROR;
+  ERR_clear_error();
+  int ret = SSL_do_handshake(ssl_);
+  if (ret == 1) {
+    established_ = true;
+    ktlsSend_ = BIO_get_ktls_send(SSL_get_wbio(ssl_)) > 0;
+    static std::atomic<bool> logged(false);
+    if (!logged.exchange(true))
+      LOG << "TLS " << SSL_get_version(ssl_) << " " << SSL_get_cipher(ssl_)
+          << (ktlsSend_ ? ", kernel TLS send offload enabled"
+                        : ", kernel TLS not available, encrypt in user space");
+    return TLS_OK;
+  }
+  switch (SSL_get_error(ssl_, ret)) {
+    case SSL_ERROR_WANT_READ:
+      return TLS_WANT_READ;
+    case SSL_ERROR_WANT_WRITE:
+      return TLS_WANT_WRITE;
+    default:
+      failed_ = true;
+      logSslErrors("TLS handshake");
+      return TLS_ERROR;
+  }
+}
+
+ssize_t TlsConn::read(Buffer &buf, bool &zero, size_t limit) {
+  ssize_t readSum = 0;
+  while (true) {
+    buf.ensureWritableBytes(kReadChunk);
+    ERR_clear_error();
+    int n = SSL_read(ssl_, buf.beginWrite(), static_cast<int>(buf.writableBytes()));
+    if (n > 0) {
+      buf.hasWritten(n);
+      readSum += n;
+      if (limit > 0 && static_cast<size_t>(readSum) >= limit) return readSum;
+      continue;
+    }
+    switch (SSL_get_error(ssl_, n)) {
+      case SSL_ERROR_WANT_READ:
+      case SSL_ERROR_WANT_WRITE:
+        return readSum;
+      case SSL_ERROR_ZERO_RETURN:
+        zero = true;
+        return readSum;
+      default:
+        failed_ = true;
+        logSslErrors("TLS read");
+        return -1;
+    }
+  }
+}
+
+ssize_t TlsConn::writeSome(const void *data, size_t len) {
+  ERR_clear_error();
+  int n = SSL_write(ssl_, data, static_cast<int>(len));
+  if (n > 0) return n;
+  int err = SSL_get_error(ssl_, n);
+  if (err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ) {
+    errno = EAGAIN;
+    return -1;
+  }
+  failed_ = true;
+  logSslErrors("TLS write");
+  if (errno == EAGAIN) errno = EPIPE;
+  return -1;
+}
+
+ssize_t TlsConn::flush(OutputQueue &queue) {
+  // 发送交给了内核：直接写fd，内存段照样sendmsg，文件段照样sendfile
+  if (ktlsSend_) return queue.flush(fd_);
+  return queue.flush(std::bind(&TlsConn::writeSome, this,
+                               std::placeholders::_1, std::placeholders::_2));
+}
+
+#else
+
+bool TlsContext::init(const std::string &, const std::string &) {
+  LOG << "TLS is not supported: built without OpenSSL";
+  return false;
+}
+
+TlsConn::TlsConn(int fd)
+    : fd_(fd),
+      ssl_(NULL),
+      established_(false),
+      ktlsSend_(false),
+      failed_(true) {}
+
+TlsConn::~TlsConn() {}
+
+TlsConn::Result TlsConn::handshake() { return TLS_ERROR; }
+
+ssize_t TlsConn::read(Buffer &, bool &, size_t) { return -1; }
+
+ssize_t TlsConn::writeSome(const void *, size_t) { return -1; }
+
+ssize_t TlsConn::flush(OutputQueue &) { return -1; }
+
+#endif
+
+void TlsConn::writeAll(const std::string &data) {
+  if (!established_) return;
+  OutputQueue queue;
+  queue.append(data);
+  flush(queue);
+}
@@ -0,0 +1,64 @@
+// @Author Wang Xin
+
+#pragma once
+#include <sys/types.h>
+#include <string>
+#include "base/noncopyable.h"
+
+#ifdef HAVE_OPENSSL
+#include <openssl/ssl.h>
+#else
+typedef struct ssl_st SSL;
+typedef struct ssl_ctx_st SSL_CTX;
+#endif
+
+class Buffer;
+class OutputQueue;
+
+/*
+所有线程共用的SSL_CTX：证书、私钥和会话缓存。
+握手完成后尽量把密钥交给内核TLS(TCP_ULP "tls")，之后发送的数据由内核加密，
+文件照样用sendfile直接从page cache发出去，不经过用户态。
+会话恢复：服务端会话缓存(TLS 1.2的session id)和会话票据(TLS 1.3以及1.2的ticket)都打开，
+同一个SSL_CTX里的票据密钥所有线程共用，客户端连到哪个EventLoop都能恢复
+*/
+class TlsContext : noncopyable {
+ public:
+  // 加载证书链和私钥，失败返回false。必须在EventLoop线程启动之前调用
+  static bool init(const std::string &certFile, const std::string &keyFile);
+  static bool enabled() { return ctx_ != NULL; }
+  static SSL_CTX *get() { return ctx_; }
+
+ private:
+  static SSL_CTX *ctx_;
+};
+
+// 一个TLS连接，非阻塞，和HttpData的fd一一对应
+class TlsConn : noncopyable {
+ public:
+  enum Result { TLS_OK = 0, TLS_WANT_READ, TLS_WANT_WRITE, TLS_ERROR };
+
+  explicit TlsConn(int fd);
+  ~TlsConn();
+
+  // 推进握手，返回TLS_OK表示握手已经完成
+  Result handshake();
+  bool established() const { return established_; }
+  // 发送方向是否交给了内核TLS，是的话输出队列可以直接写fd，文件段照样sendfile
+  bool ktlsSend() const { return ktlsSend_; }
+  // 解密后的数据读进buf，读到没有数据为止，返回值、zero和limit的语义同readn(fd, Buffer&, zero, limit)
+  ssize_t read(Buffer &buf, bool &zero, size_t limit = 0);
+  // 发送输出队列，返回值同OutputQueue::flush
+  ssize_t flush(OutputQueue &queue);
+  // 错误页之类不考虑写不完的数据
+  void writeAll(const std::string &data);
+
+ private:
+  ssize_t writeSome(const void *data, size_t len);
+
+  int fd_;
+  SSL *ssl_;
+  bool established_;
+  bool ktlsSend_;
+  bool failed_;
+};
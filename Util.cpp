@@ -1,7 +1,9 @@
 // @Author Wang Xin
 
 #include "Util.h"
+#include "Buffer.h"
 
+#include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <netinet/in.h>
@@ -9,7 +11,10 @@
 #include <signal.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <unistd.h>
+#include <zlib.h>
 
 
 const int MAX_BUFF = 4096;
@@ -145,6 +150,67 @@ ssize_t writen(int fd, std::string &sbuff) {
   return writeSum;
 }
 
+ssize_t readn(int fd, Buffer &inBuffer, bool &zero, size_t limit) {
+  ssize_t readSum = 0;
+  while (true) {
+    int savedErrno = 0;
+    ssize_t nread = inBuffer.readFd(fd, &savedErrno);
+    if (nread < 0) {
+      if (savedErrno == EINTR)
+        continue;
+      else if (savedErrno == EAGAIN) {
+        return readSum;
+      } else {
+        errno = savedErrno;
+        perror("read error");
+        return -1;
+      }
+    } else if (nread == 0) {
+      zero = true;
+      break;
+    }
+    readSum += nread;
+    if (limit > 0 && static_cast<size_t>(readSum) >= limit) break;
+  }
+  return readSum;
+}
+
+ssize_t writen(int fd, Buffer &sbuff) {
+  ssize_t writeSum = 0;
+  while (sbuff.readableBytes() > 0) {
+    ssize_t nwritten = write(fd, sbuff.peek(), sbuff.readableBytes());
+    if (nwritten < 0) {
+      if (errno == EINTR)
+        continue;
+      else if (errno == EAGAIN)
+        break;
+      else
+        return -1;
+    }
+    writeSum += nwritten;
+    sbuff.retrieve(nwritten);// 只移动readerIndex_，剩下的数据不用拷贝
+  }
+  return writeSum;
+}
+
+bool gzipCompress(const std::string &data, std::string &out) {
+  z_stream zs;
+  memset(&zs, 0, sizeof zs);
+  // windowBits加16表示输出带gzip头和尾，而不是裸的zlib格式
+  if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK)
+    return false;
+  out.resize(deflateBound(&zs, data.size()));
+  zs.next_in = (Bytef *)data.data();
+  zs.avail_in = data.size();
+  zs.next_out = (Bytef *)&out[0];
+  zs.avail_out = out.size();
+  int ret = deflate(&zs, Z_FINISH);
+  out.resize(zs.total_out);
+  deflateEnd(&zs);
+  return ret == Z_STREAM_END;
+}
+
 void handle_for_sigpipe() {
   /*
   进程收到SIGPIPE信号后的默认行为是终止进程，假如客户端关闭了连接，服务进程又繁忙，
@@ -185,40 +251,99 @@ void shutDownWR(int fd) {
   // printf("shutdown\n");
 }
 
-int socket_bind_listen(int port) {
+int socket_bind_listen(int port, bool reusePort) {
+  ListenOptions opts;
+  opts.reusePort = reusePort;
+  return socket_bind_listen(ListenAddr(AF_INET, port), opts);
+}
+
+int socket_bind_listen(const ListenAddr &addr, const ListenOptions &opts) {
+  bool isTcp = addr.family == AF_INET || addr.family == AF_INET6;
   // 检查port值，取正确区间范围
-  if (port < 0 || port > 65535) return -1;
+  if (isTcp && (addr.port < 0 || addr.port > 65535)) return -1;
+  if (!isTcp && (addr.family != AF_UNIX || addr.path.empty() ||
+                 addr.path.size() >= sizeof(((sockaddr_un *)0)->sun_path)))
+    return -1;
+  if (!isTcp) {
+    // 上次运行留下的socket文件会让bind失败，先删掉；同名的不是socket就不动它，直接失败
+    struct stat st;
+    if (lstat(addr.path.c_str(), &st) == 0) {
+      if (!S_ISSOCK(st.st_mode) || unlink(addr.path.c_str()) == -1) return -1;
+    } else if (errno != ENOENT) {
+      return -1;
+    }
+  }
 
-  // 创建socket(IPv4 + TCP)，返回监听描述符
+  // 创建socket(IPv4/IPv6 + TCP，或者AF_UNIX流式socket)，返回监听描述符
   int listen_fd = 0;
-  if ((listen_fd = socket(AF_INET, SOCK_STREAM, 0)) == -1) return -1;
+  if ((listen_fd = socket(addr.family, SOCK_STREAM, 0)) == -1) return -1;
 
   // 消除bind时"Address already in use"错误，让端口释放后就可以立即被再次使用。SO_REUSEADDR对处于TIME_WAIT状态下的socket TCP套接字可以立即重复绑定使用
   int optval = 1;
-  if (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &optval,
+  if (isTcp && setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &optval,
+                          sizeof(optval)) == -1) {
+    close(listen_fd);
+    return -1;
+  }
+
+  // SO_REUSEPORT允许多个socket绑定同一个端口，内核会把到达的连接请求均匀地分给这些socket，每个EventLoop各自监听、各自accept
+  if (isTcp && opts.reusePort &&
+      setsockopt(listen_fd, SOL_SOCKET, SO_REUSEPORT, &optval,
                  sizeof(optval)) == -1) {
     close(listen_fd);
     return -1;
   }
 
   // 设置服务器IP和Port，和监听描述副绑定
-  struct sockaddr_in server_addr;
+  struct sockaddr_storage server_addr;
+  socklen_t addr_len = 0;
   bzero((char *)&server_addr, sizeof(server_addr));
-  server_addr.sin_family = AF_INET;
-  server_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-  server_addr.sin_port = htons((unsigned short)port);
-  if (bind(listen_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) ==
-      -1) {
+  if (addr.family == AF_INET) {
+    struct sockaddr_in *in4 = (struct sockaddr_in *)&server_addr;
+    in4->sin_family = AF_INET;
+    in4->sin_addr.s_addr = htonl(INADDR_ANY);
+    in4->sin_port = htons((unsigned short)addr.port);
+    addr_len = sizeof(*in4);
+  } else if (addr.family == AF_INET6) {
+    // 只监听IPv6，这样同一个端口还可以再单独监听IPv4
+    if (setsockopt(listen_fd, IPPROTO_IPV6, IPV6_V6ONLY, &optval,
+                   sizeof(optval)) == -1) {
+      close(listen_fd);
+      return -1;
+    }
+    struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)&server_addr;
+    in6->sin6_family = AF_INET6;
+    in6->sin6_addr = in6addr_any;
+    in6->sin6_port = htons((unsigned short)addr.port);
+    addr_len = sizeof(*in6);
+  } else {
+    // 上面已经检查过长度，连同结尾的'\0'一起放得下
+    struct sockaddr_un *un = (struct sockaddr_un *)&server_addr;
+    un->sun_family = AF_UNIX;
+    memcpy(un->sun_path, addr.path.c_str(), addr.path.size() + 1);
+    addr_len = sizeof(*un);
+  }
+  if (bind(listen_fd, (struct sockaddr *)&server_addr, addr_len) == -1) {
     close(listen_fd);
     return -1;
   }
 
-  // 开始监听，最大等待队列长为LISTENQ
-  if (listen(listen_fd, 2048) == -1) {
+  // 开始监听，最大等待队列长为opts.backlog
+  if (listen(listen_fd, opts.backlog) == -1) {
     close(listen_fd);
     return -1;
   }
 
+  // 这两个选项内核不支持时只是失去优化，不影响服务，所以失败了也不关闭socket
+  if (isTcp && opts.deferAccept > 0 &&
+      setsockopt(listen_fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &opts.deferAccept,
+                 sizeof(opts.deferAccept)) == -1)
+    perror("set TCP_DEFER_ACCEPT failed");
+  if (isTcp && opts.fastOpen > 0 &&
+      setsockopt(listen_fd, IPPROTO_TCP, TCP_FASTOPEN, &opts.fastOpen,
+                 sizeof(opts.fastOpen)) == -1)
+    perror("set TCP_FASTOPEN failed");
+
   // 无效监听描述符
   if (listen_fd == -1) {
     close(listen_fd);
@@ -226,3 +351,18 @@ int socket_bind_listen(int port) {
   }
   return listen_fd;
 }
+
+std::string sockaddrToString(const struct sockaddr *addr) {
+  char buf[INET6_ADDRSTRLEN] = "";
+  if (addr->sa_family == AF_INET) {
+    const struct sockaddr_in *in4 = (const struct sockaddr_in *)addr;
+    inet_ntop(AF_INET, &in4->sin_addr, buf, sizeof buf);
+    return std::string(buf) + ":" + std::to_string(ntohs(in4->sin_port));
+  } else if (addr->sa_family == AF_INET6) {
+    const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *)addr;
+    inet_ntop(AF_INET6, &in6->sin6_addr, buf, sizeof buf);
+    return "[" + std::string(buf) + "]:" +
+           std::to_string(ntohs(in6->sin6_port));
+  }
+  return "unix";
+}
@@ -1,17 +1,49 @@
 // @Author Wang Xin
 
 #pragma once
+#include <sys/socket.h>
 #include <cstdlib>
 #include <string>
 
+class Buffer;
+
+// 监听地址：IPv4/IPv6的TCP端口，或者本机的AF_UNIX路径
+struct ListenAddr {
+  int family;// AF_INET, AF_INET6 或 AF_UNIX
+  int port;
+  std::string path;// 只对AF_UNIX有效
+  bool tls;// 这个地址上accept到的连接先做TLS握手
+  ListenAddr(int f, int p, bool t = false) : family(f), port(p), tls(t) {}
+  ListenAddr(const std::string &unixPath)
+      : family(AF_UNIX), port(0), path(unixPath), tls(false) {}
+};
+
+// 监听socket的可调参数，deferAccept和fastOpen只对TCP有效
+struct ListenOptions {
+  int backlog;// listen()的等待队列长度
+  int deferAccept;// TCP_DEFER_ACCEPT的秒数：连接上有数据到达后才唤醒accept，0表示不开启
+  int fastOpen;// TCP_FASTOPEN的队列长度：老客户端可以在SYN里带上请求，省一个RTT，0表示不开启
+  bool reusePort;
+  ListenOptions()
+      : backlog(2048), deferAccept(0), fastOpen(0), reusePort(false) {}
+};
+
 ssize_t readn(int fd, void *buff, size_t n);
 ssize_t readn(int fd, std::string &inBuffer, bool &zero);
 ssize_t readn(int fd, std::string &inBuffer);
 ssize_t writen(int fd, void *buff, size_t n);
 ssize_t writen(int fd, std::string &sbuff);
+// 读到EAGAIN为止，对端关闭时zero为true；limit不为0时读到不少于limit字节就先返回
+ssize_t readn(int fd, Buffer &inBuffer, bool &zero, size_t limit = 0);
+// 写到EAGAIN为止，写出去的数据从sbuff中移除
+ssize_t writen(int fd, Buffer &sbuff);
+// 把data压缩成gzip格式写到out中
+bool gzipCompress(const std::string &data, std::string &out);
 void handle_for_sigpipe();
 int setSocketNonBlocking(int fd);
 void setSocketNodelay(int fd);
 void setSocketNoLinger(int fd);
 void shutDownWR(int fd);
-int socket_bind_listen(int port);
\ No newline at end of file
+int socket_bind_listen(int port, bool reusePort = false);
+int socket_bind_listen(const ListenAddr &addr, const ListenOptions &opts);
+std::string sockaddrToString(const struct sockaddr *addr);
\ No newline at end of file
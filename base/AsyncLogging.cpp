@@ -5,10 +5,12 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <functional>
+#include "CurrentThread.h"
 #include "LogFile.h"
 
-AsyncLogging::AsyncLogging(std::string logFileName_, int flushInterval)
+AsyncLogging::AsyncLogging(std::string logFileName_, int flushInterval, int cpu)
     : flushInterval_(flushInterval),
+      cpu_(cpu),
       running_(false),
       basename_(logFileName_),
       thread_(std::bind(&AsyncLogging::threadFunc, this), "Logging"),
@@ -42,6 +44,7 @@ void AsyncLogging::append(const char* logline, int len) {
 
 void AsyncLogging::threadFunc() {
   assert(running_ == true);
+  CurrentThread::bindToCpu(cpu_);
   latch_.countDown();
   LogFile output(basename_);
   BufferPtr newBuffer1(new Buffer);
@@ -13,7 +13,7 @@
 
 class AsyncLogging : noncopyable {
  public:
-  AsyncLogging(const std::string basename, int flushInterval = 2);
+  AsyncLogging(const std::string basename, int flushInterval = 2, int cpu = -1);
   ~AsyncLogging() {
     if (running_) stop();
   }
@@ -37,6 +37,7 @@ class AsyncLogging : noncopyable {
   typedef std::vector<std::shared_ptr<Buffer>> BufferVector;
   typedef std::shared_ptr<Buffer> BufferPtr;
   const int flushInterval_;
+  const int cpu_;// 日志线程绑定的CPU核，-1表示不绑定
   bool running_;
   std::string basename_;
   Thread thread_;
@@ -10,6 +10,9 @@ extern __thread char t_tidString[32];// tid格式化为字符串形式
 extern __thread int t_tidStringLength;// tid占用几个字节
 extern __thread const char* t_threadName;
 void cacheTid();
+// 把当前线程绑定到指定的CPU核上，cpu < 0时不做任何事。
+// 绑核之后再分配的内存按first-touch策略落在该核所在的NUMA节点上
+bool bindToCpu(int cpu);
 inline int tid() {
   if (__builtin_expect(t_cachedTid == 0, 0)) {
     cacheTid();
@@ -14,10 +14,12 @@ static pthread_once_t once_control_ = PTHREAD_ONCE_INIT;
 static AsyncLogging *AsyncLogger_;
 
 std::string Logger::logFileName_ = "./WebServer.log";
+int Logger::logThreadCpu_ = -1;
 
 void once_init()
 {
-    AsyncLogger_ = new AsyncLogging(Logger::getLogFileName());
+    AsyncLogger_ = new AsyncLogging(Logger::getLogFileName(), 2,
+                                    Logger::getLogThreadCpu());
     AsyncLogger_->start(); 
 }
 
@@ -18,6 +18,9 @@ class Logger {
 
   static void setLogFileName(std::string fileName) { logFileName_ = fileName; }
   static std::string getLogFileName() { return logFileName_; }
+  // 必须在第一次LOG之前调用，日志线程在第一次LOG时才创建
+  static void setLogThreadCpu(int cpu) { logThreadCpu_ = cpu; }
+  static int getLogThreadCpu() { return logThreadCpu_; }
 
  private:
   class Impl {
@@ -31,6 +34,7 @@ class Logger {
   };
   Impl impl_;
   static std::string logFileName_;
+  static int logThreadCpu_;
 };
 
 #define LOG Logger(__FILE__, __LINE__).stream()
\ No newline at end of file
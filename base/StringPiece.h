@@ -0,0 +1,51 @@
+// @Author Wang Xin
+
+#pragma once
+#include <string.h>
+#include <string>
+
+// 只记指针和长度的字符串片段，不拥有数据，用来在不拷贝的情况下引用缓冲区中的一段
+// (C++11里还没有std::string_view)。引用的数据必须比StringPiece活得久
+class StringPiece {
+ public:
+  StringPiece() : ptr_(NULL), length_(0) {}
+  StringPiece(const char *str) : ptr_(str), length_(strlen(str)) {}
+  StringPiece(const std::string &str) : ptr_(str.data()), length_(str.size()) {}
+  StringPiece(const char *offset, size_t len) : ptr_(offset), length_(len) {}
+
+  const char *data() const { return ptr_; }
+  size_t size() const { return length_; }
+  bool empty() const { return length_ == 0; }
+  const char *begin() const { return ptr_; }
+  const char *end() const { return ptr_ + length_; }
+  char operator[](size_t i) const { return ptr_[i]; }
+
+  void clear() {
+    ptr_ = NULL;
+    length_ = 0;
+  }
+  void set(const char *buffer, size_t len) {
+    ptr_ = buffer;
+    length_ = len;
+  }
+  void remove_prefix(size_t n) {
+    ptr_ += n;
+    length_ -= n;
+  }
+  void remove_suffix(size_t n) { length_ -= n; }
+
+  bool operator==(const StringPiece &x) const {
+    return length_ == x.length_ && memcmp(ptr_, x.ptr_, length_) == 0;
+  }
+  bool operator!=(const StringPiece &x) const { return !(*this == x); }
+  bool starts_with(const StringPiece &x) const {
+    return length_ >= x.length_ && memcmp(ptr_, x.ptr_, x.length_) == 0;
+  }
+
+  std::string as_string() const { return std::string(ptr_, length_); }
+  void copyTo(std::string *target) const { target->assign(ptr_, length_); }
+
+ private:
+  const char *ptr_;
+  size_t length_;
+};
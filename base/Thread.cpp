@@ -4,6 +4,8 @@
 #include <assert.h>
 #include <errno.h>
 #include <linux/unistd.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <sys/prctl.h>
@@ -33,6 +35,18 @@ void CurrentThread::cacheTid() {
   }
 }
 
+bool CurrentThread::bindToCpu(int cpu) {
+  if (cpu < 0 || cpu >= CPU_SETSIZE) return false;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  if (pthread_setaffinity_np(pthread_self(), sizeof set, &set) != 0) {
+    fprintf(stderr, "bind thread %d to cpu %d failed\n", tid(), cpu);
+    return false;
+  }
+  return true;
+}
+
 // 为了在线程中保留name,tid这些数据
 struct ThreadData {
   typedef Thread::ThreadFunc ThreadFunc;
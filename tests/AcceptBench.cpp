@@ -0,0 +1,82 @@
+// @Author Wang Xin
+
+// 短连接压测：每个线程循环执行 connect -> 发送一个请求 -> 读到响应 -> close，
+// 统计服务器每秒能接受并处理的连接数。
+// 用法：AcceptBench [ip] [port] [线程数] [秒数] [请求路径]
+// 分别对改动前后编译出的WebServer运行，比较输出的accepts/sec即可
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <atomic>
+#include <vector>
+
+using namespace std;
+
+static struct sockaddr_in servaddr;
+static char g_request[1024];
+static std::atomic<long> g_done(0);
+static std::atomic<long> g_failed(0);
+static volatile bool g_stop = false;
+
+static double nowSeconds() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void *worker(void *) {
+  const char *req = g_request;
+  char buff[4096];
+  while (!g_stop) {
+    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sockfd < 0) {
+      ++g_failed;
+      continue;
+    }
+    // 服务器丢掉连接时不要让压测线程永远阻塞在read上
+    struct timeval tv = {1, 0};
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+    if (connect(sockfd, (struct sockaddr *)&servaddr, sizeof(servaddr)) != 0 ||
+        write(sockfd, req, strlen(req)) < 0 || read(sockfd, buff, sizeof buff) <= 0)
+      ++g_failed;
+    else
+      ++g_done;
+    close(sockfd);
+  }
+  return NULL;
+}
+
+int main(int argc, char *argv[]) {
+  const char *ip = argc > 1 ? argv[1] : "127.0.0.1";
+  int port = argc > 2 ? atoi(argv[2]) : 12345;
+  int threadNum = argc > 3 ? atoi(argv[3]) : 8;
+  int seconds = argc > 4 ? atoi(argv[4]) : 5;
+  const char *path = argc > 5 ? argv[5] : "/hello";
+  snprintf(g_request, sizeof g_request,
+           "GET %s HTTP/1.1\r\nHost: bench\r\n\r\n", path);
+
+  bzero(&servaddr, sizeof(servaddr));
+  servaddr.sin_family = AF_INET;
+  servaddr.sin_port = htons(port);
+  inet_pton(AF_INET, ip, &servaddr.sin_addr);
+
+  std::vector<pthread_t> threads(threadNum);
+  double start = nowSeconds();
+  for (int i = 0; i < threadNum; ++i)
+    pthread_create(&threads[i], NULL, worker, NULL);
+  sleep(seconds);
+  g_stop = true;
+  for (int i = 0; i < threadNum; ++i) pthread_join(threads[i], NULL);
+  double elapsed = nowSeconds() - start;
+
+  printf("threads=%d seconds=%.2f done=%ld failed=%ld accepts/sec=%.0f\n",
+         threadNum, elapsed, g_done.load(), g_failed.load(),
+         g_done.load() / elapsed);
+  return 0;
+}
@@ -0,0 +1,575 @@
+// @Author Wang Xin
+
+// 请求行和头部解析的微基准：
+//   请求行：原来基于std::string查找的解析方式和HttpParser，输出每个请求行的平均耗时(ns)
+//   头部：原来逐字节的状态机和HttpParser::parseHeaderLine在各种扫描实现(scalar/sse4.2/avx2)下，
+//         输出解析一组约1KB头部的平均耗时(ns)
+// 开始计时前先检查一遍HttpParser的解析结果、各种扫描实现的结果是否一致，以及ChunkedDecoder的解码结果。
+// 用法：ParserBench [轮数]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "../HttpChunked.h"
+#include "../HttpHeaders.h"
+#include "../HttpParser.h"
+
+using namespace std;
+
+static double nowSeconds() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+// 改动前HttpData::parseURI的做法：拷贝出请求行，在整行里找"GET"/"POST"/"HEAD"，再用substr取出各部分
+static bool legacyParse(const string &buffer, HttpMethod &method,
+                        HttpVersion &version, string &fileName, string &uri) {
+  size_t pos = buffer.find('\r');
+  if (pos == string::npos) return false;
+  string request_line = buffer.substr(0, pos);
+  int posGet = request_line.find("GET");
+  int posPost = request_line.find("POST");
+  int posHead = request_line.find("HEAD");
+  if (posGet >= 0) {
+    pos = posGet;
+    method = METHOD_GET;
+  } else if (posPost >= 0) {
+    pos = posPost;
+    method = METHOD_POST;
+  } else if (posHead >= 0) {
+    pos = posHead;
+    method = METHOD_HEAD;
+  } else {
+    return false;
+  }
+  pos = request_line.find("/", pos);
+  if (pos == string::npos) return false;
+  size_t _pos = request_line.find(' ', pos);
+  if (_pos == string::npos) return false;
+  uri = request_line.substr(pos, _pos - pos);
+  if (_pos - pos > 1) {
+    fileName = request_line.substr(pos + 1, _pos - pos - 1);
+    size_t __pos = fileName.find('?');
+    if (__pos != string::npos) fileName = fileName.substr(0, __pos);
+  } else {
+    fileName = "index.html";
+  }
+  pos = request_line.find("/", _pos);
+  if (pos == string::npos || request_line.size() - pos <= 3) return false;
+  string ver = request_line.substr(pos + 1, 3);
+  if (ver == "1.0")
+    version = HTTP_10;
+  else if (ver == "1.1")
+    version = HTTP_11;
+  else
+    return false;
+  return true;
+}
+
+// 和HttpData::parseURI一样，只有取出文件名和URI时才拷贝
+static bool newParse(const string &buffer, HttpMethod &method,
+                     HttpVersion &version, string &fileName, string &uri) {
+  const char *begin = buffer.data();
+  const char *cr =
+      static_cast<const char *>(memchr(begin, '\r', buffer.size()));
+  if (cr == NULL) return false;
+  RequestLine line;
+  if (HttpParser::parseRequestLine(begin, cr, &line) != REQUEST_LINE_OK)
+    return false;
+  method = line.method;
+  version = line.version;
+  line.target.copyTo(&uri);
+  if (line.path.size() > 1)
+    fileName.assign(line.path.data() + 1, line.path.size() - 1);
+  else
+    fileName = "index.html";
+  return true;
+}
+
+struct Case {
+  const char *line;
+  RequestLineResult result;
+  HttpMethod method;
+  const char *path;
+  const char *query;
+};
+
+static int checkParser() {
+  static const Case cases[] = {
+      {"GET / HTTP/1.1", REQUEST_LINE_OK, METHOD_GET, "/", ""},
+      {"GET /index.html?a=1&b=2 HTTP/1.0", REQUEST_LINE_OK, METHOD_GET,
+       "/index.html", "a=1&b=2"},
+      {"POST /GET/HEAD HTTP/1.1", REQUEST_LINE_OK, METHOD_POST, "/GET/HEAD", ""},
+      {"PUT /a HTTP/1.1", REQUEST_LINE_OK, METHOD_PUT, "/a", ""},
+      {"DELETE /a HTTP/1.1", REQUEST_LINE_OK, METHOD_DELETE, "/a", ""},
+      {"OPTIONS * HTTP/1.1", REQUEST_LINE_OK, METHOD_OPTIONS, "", ""},
+      {"PATCH /a? HTTP/1.1", REQUEST_LINE_OK, METHOD_PATCH, "/a", ""},
+      {"CONNECT example.com:443 HTTP/1.1", REQUEST_LINE_OK, METHOD_CONNECT, "",
+       ""},
+      {"TRACE /x HTTP/1.1", REQUEST_LINE_OK, METHOD_TRACE, "/x", ""},
+      {"GET http://example.com/p?q HTTP/1.1", REQUEST_LINE_OK, METHOD_GET, "/p",
+       "q"},
+      {"GET http://example.com HTTP/1.1", REQUEST_LINE_OK, METHOD_GET, "/", ""},
+      {"get / HTTP/1.1", REQUEST_LINE_UNKNOWN_METHOD, METHOD_GET, "", ""},
+      {"BREW /pot HTTP/1.1", REQUEST_LINE_UNKNOWN_METHOD, METHOD_GET, "", ""},
+      {"G(T / HTTP/1.1", REQUEST_LINE_BAD_METHOD, METHOD_GET, "", ""},
+      {" / HTTP/1.1", REQUEST_LINE_BAD_METHOD, METHOD_GET, "", ""},
+      {"GET  HTTP/1.1", REQUEST_LINE_BAD_TARGET, METHOD_GET, "", ""},
+      {"GET /a\tb HTTP/1.1", REQUEST_LINE_BAD_TARGET, METHOD_GET, "", ""},
+      {"GET * HTTP/1.1", REQUEST_LINE_BAD_TARGET, METHOD_GET, "", ""},
+      {"GET index.html HTTP/1.1", REQUEST_LINE_BAD_TARGET, METHOD_GET, "", ""},
+      {"CONNECT /a HTTP/1.1", REQUEST_LINE_BAD_TARGET, METHOD_GET, "", ""},
+      {"GET / HTTP/2.0", REQUEST_LINE_UNSUPPORTED_VERSION, METHOD_GET, "", ""},
+      {"GET / HTTP/1.2", REQUEST_LINE_UNSUPPORTED_VERSION, METHOD_GET, "", ""},
+      {"GET / HTTP/1", REQUEST_LINE_BAD_VERSION, METHOD_GET, "", ""},
+      {"GET / http/1.1", REQUEST_LINE_BAD_VERSION, METHOD_GET, "", ""},
+      {"GET / HTTP/1.1 x", REQUEST_LINE_MALFORMED, METHOD_GET, "", ""},
+      {"GET /", REQUEST_LINE_MALFORMED, METHOD_GET, "", ""},
+      {"GET", REQUEST_LINE_MALFORMED, METHOD_GET, "", ""},
+  };
+  int failed = 0;
+  for (size_t i = 0; i < sizeof cases / sizeof cases[0]; ++i) {
+    const Case &c = cases[i];
+    RequestLine line;
+    RequestLineResult result =
+        HttpParser::parseRequestLine(c.line, c.line + strlen(c.line), &line);
+    bool ok = result == c.result;
+    if (ok && result == REQUEST_LINE_OK)
+      ok = line.method == c.method && line.path == StringPiece(c.path) &&
+           line.query == StringPiece(c.query);
+    if (!ok) {
+      printf("FAIL: \"%s\" -> %d, expect %d\n", c.line, result, c.result);
+      ++failed;
+    }
+  }
+  return failed;
+}
+
+struct HeaderCase {
+  const char *input;
+  HeaderLineResult result;
+  const char *name;
+  const char *value;
+};
+
+static int checkHeaderLine() {
+  static const HeaderCase cases[] = {
+      {"Host: a\r\n", HEADER_LINE_OK, "Host", "a"},
+      {"Host:a\r\n", HEADER_LINE_OK, "Host", "a"},
+      {"Accept: \t text/html \t\r\n", HEADER_LINE_OK, "Accept", "text/html"},
+      {"X-Obs: caf\xc3\xa9\r\n", HEADER_LINE_OK, "X-Obs", "caf\xc3\xa9"},
+      {"X-Empty:\r\n", HEADER_LINE_OK, "X-Empty", ""},
+      {"\r\n", HEADER_LINE_END, "", ""},
+      {"\r", HEADER_LINE_AGAIN, "", ""},
+      {"Host: a", HEADER_LINE_AGAIN, "", ""},
+      {"Host: a\r", HEADER_LINE_AGAIN, "", ""},
+      {"Hos", HEADER_LINE_AGAIN, "", ""},
+      {"Host : a\r\n", HEADER_LINE_ERROR, "", ""},
+      {": a\r\n", HEADER_LINE_ERROR, "", ""},
+      {"Ho(st: a\r\n", HEADER_LINE_ERROR, "", ""},
+      {"Host: a\nb\r\n", HEADER_LINE_ERROR, "", ""},
+      {"Host: a\x01\r\n", HEADER_LINE_ERROR, "", ""},
+      {"Host: a\rb\n", HEADER_LINE_ERROR, "", ""},
+      {"\rx", HEADER_LINE_ERROR, "", ""},
+  };
+  int failed = 0;
+  for (size_t i = 0; i < sizeof cases / sizeof cases[0]; ++i) {
+    const HeaderCase &c = cases[i];
+    HeaderField field;
+    const char *next;
+    HeaderLineResult result = HttpParser::parseHeaderLine(
+        c.input, c.input + strlen(c.input), &field, &next);
+    bool ok = result == c.result;
+    if (ok && result == HEADER_LINE_OK)
+      ok = field.name == StringPiece(c.name) &&
+           field.value == StringPiece(c.value) &&
+           next == c.input + strlen(c.input);
+    if (!ok) {
+      printf("FAIL: header \"%s\" -> %d, expect %d\n", c.input, result,
+             c.result);
+      ++failed;
+    }
+  }
+  return failed;
+}
+
+struct ChunkedCase {
+  const char *input;
+  bool ok;
+  const char *body;// ok时解出来的数据
+  size_t used;// ok时属于这个消息的字节数，后面可能跟着下一个请求
+};
+
+// 一次给全部输入和每次只给一个字节，解出来的数据和消息的边界都要一样
+static int checkChunked() {
+  static const ChunkedCase cases[] = {
+      {"5\r\nhello\r\n0\r\n\r\n", true, "hello", 15},
+      {"3\r\nabc\r\n2;ext=1\r\nde\r\n0\r\n\r\nGET", true, "abcde", 26},
+      {"A \r\n0123456789\r\n0\r\nX-Sum: 1\r\n\r\n", true, "0123456789", 31},
+      {"0\r\n\r\n", true, "", 5},
+      {"\r\n", false, "", 0},
+      {"g\r\n", false, "", 0},
+      {"5\r\nhelloX\r\n", false, "", 0},
+      {"5\nhello\r\n0\r\n\r\n", false, "", 0},
+      {"1000000000000000\r\n", false, "", 0},
+      {"0\r\nX: \x01\r\n\r\n", false, "", 0},
+  };
+  int failed = 0;
+  for (size_t i = 0; i < sizeof cases / sizeof cases[0]; ++i) {
+    const ChunkedCase &c = cases[i];
+    size_t len = strlen(c.input);
+    for (int bytewise = 0; bytewise < 2; ++bytewise) {
+      ChunkedDecoder decoder;
+      string body;
+      size_t used = 0;
+      while (used < len && !decoder.done() && !decoder.error()) {
+        StringPiece piece;
+        size_t avail = bytewise ? 1 : len - used;
+        used += decoder.decode(c.input + used, avail, &piece);
+        body.append(piece.data(), piece.size());
+      }
+      bool ok = c.ok ? decoder.done() && body == c.body && used == c.used &&
+                           decoder.bodyBytes() == body.size()
+                     : decoder.error();
+      if (!ok) {
+        printf("FAIL: chunked case %zu (%s) -> done=%d error=%d used=%zu\n",
+               i, bytewise ? "bytewise" : "whole", decoder.done(),
+               decoder.error(), used);
+        ++failed;
+      }
+    }
+  }
+  char head[ChunkedEncoder::kMaxHeader];
+  if (string(head, ChunkedEncoder::formatHeader(0x1a2b, head)) != "1a2b\r\n" ||
+      string(head, ChunkedEncoder::formatHeader(0, head)) != "0\r\n") {
+    printf("FAIL: chunk header\n");
+    ++failed;
+  }
+  return failed;
+}
+
+// 各种SIMD实现在随机数据的每个起点上都要和逐字节查表的结果一致
+static int checkScanners() {
+  static const char alphabet[] = "aZ09-_:|~{} \t\r\n\x01\x7f\x80\xff\"(/@[";
+  string data(4096, 'a');
+  srand(1);
+  for (size_t i = 0; i < data.size(); ++i)
+    if (rand() % 8 == 0) data[i] = alphabet[rand() % (sizeof alphabet - 1)];
+  const char *begin = data.data();
+  const char *end = begin + data.size();
+  vector<const char *> token, value;
+  HttpParser::setScanImpl(HttpParser::SCAN_SCALAR);
+  for (const char *p = begin; p < end; ++p) {
+    token.push_back(HttpParser::scanToken(p, end));
+    value.push_back(HttpParser::scanFieldValue(p, end));
+  }
+  int failed = 0;
+  for (int impl = HttpParser::SCAN_SSE42; impl <= HttpParser::SCAN_AVX2;
+       ++impl) {
+    if (HttpParser::setScanImpl(static_cast<HttpParser::ScanImpl>(impl)) !=
+        impl)
+      continue;
+    for (const char *p = begin; p < end; ++p) {
+      if (HttpParser::scanToken(p, end) != token[p - begin] ||
+          HttpParser::scanFieldValue(p, end) != value[p - begin]) {
+        printf("FAIL: %s scanner differs at offset %ld\n",
+               HttpParser::scanImplName(
+                   static_cast<HttpParser::ScanImpl>(impl)),
+               static_cast<long>(p - begin));
+        ++failed;
+        break;
+      }
+    }
+  }
+  return failed;
+}
+
+// 改动前HttpData::parseHeaders的做法：逐字节走状态机，结果放进map。headers为NULL时只解析不保存
+static bool legacyHeaders(const string &buffer, map<string, string> *headers,
+                          HttpHeaders *) {
+  enum {
+    H_START = 0,
+    H_KEY,
+    H_COLON,
+    H_SPACES_AFTER_COLON,
+    H_VALUE,
+    H_CR,
+    H_LF,
+    H_END_CR,
+    H_END_LF
+  } hState = H_START;
+  const char *str = buffer.data();
+  const size_t len = buffer.size();
+  int key_start = -1, key_end = -1, value_start = -1, value_end = -1;
+  bool notFinish = true;
+  for (size_t i = 0; i < len && notFinish; ++i) {
+    switch (hState) {
+      case H_START:
+        if (str[i] == '\n' || str[i] == '\r') break;
+        hState = H_KEY;
+        key_start = i;
+        break;
+      case H_KEY:
+        if (str[i] == ':') {
+          key_end = i;
+          if (key_end - key_start <= 0) return false;
+          hState = H_COLON;
+        } else if (str[i] == '\n' || str[i] == '\r')
+          return false;
+        break;
+      case H_COLON:
+        if (str[i] != ' ') return false;
+        hState = H_SPACES_AFTER_COLON;
+        break;
+      case H_SPACES_AFTER_COLON:
+        hState = H_VALUE;
+        value_start = i;
+        break;
+      case H_VALUE:
+        if (str[i] == '\r') {
+          hState = H_CR;
+          value_end = i;
+          if (value_end - value_start <= 0) return false;
+        } else if (i - value_start > 255)
+          return false;
+        break;
+      case H_CR:
+        if (str[i] != '\n') return false;
+        hState = H_LF;
+        if (headers)
+          (*headers)[string(str + key_start, str + key_end)] =
+              string(str + value_start, str + value_end);
+        break;
+      case H_LF:
+        if (str[i] == '\r') {
+          hState = H_END_CR;
+        } else {
+          key_start = i;
+          hState = H_KEY;
+        }
+        break;
+      case H_END_CR:
+        if (str[i] != '\n') return false;
+        hState = H_END_LF;
+        notFinish = false;
+        break;
+      case H_END_LF:
+        notFinish = false;
+        break;
+    }
+  }
+  return hState == H_END_LF;
+}
+
+// 和HttpData::parseHeaders一样逐行解析后放进HttpHeaders，index为NULL时只解析不保存
+static bool newHeaders(const string &buffer, map<string, string> *,
+                       HttpHeaders *index) {
+  const char *p = buffer.data();
+  const char *end = p + buffer.size();
+  if (p < end && *p == '\n') ++p;
+  while (true) {
+    HeaderField field;
+    const char *next;
+    HeaderLineResult result =
+        HttpParser::parseHeaderLine(p, end, &field, &next);
+    if (result == HEADER_LINE_END) return true;
+    if (result != HEADER_LINE_OK) return false;
+    if (index) index->add(field.name, field.value);
+    p = next;
+  }
+}
+
+typedef bool (*HeadersFunc)(const string &, map<string, string> *,
+                            HttpHeaders *);
+
+static double benchHeaders(HeadersFunc parse, const string &block, int rounds,
+                           bool store) {
+  map<string, string> headers;
+  HttpHeaders index;
+  long ok = 0;
+  double start = nowSeconds();
+  for (int r = 0; r < rounds; ++r) {
+    headers.clear();
+    index.clear();
+    ok += parse(block, store ? &headers : NULL, store ? &index : NULL);
+  }
+  double elapsed = nowSeconds() - start;
+  if (ok != rounds) printf("unexpected header parse failures: %ld\n", rounds - ok);
+  return elapsed * 1e9 / rounds;
+}
+
+static int checkHeaders() {
+  HttpHeaders headers;
+  int failed = 0;
+  for (int round = 0; round < 2; ++round) {
+    headers.clear();
+    headers.add("content-length", "12");
+    headers.add("X-Forwarded-For", "a");
+    headers.add("CONNECTION", "close");
+    headers.add("x-forwarded-for", "b");
+    headers.add("Connection", "Keep-Alive");
+    StringPiece value;
+    if (!headers.has(HEADER_CONTENT_LENGTH) ||
+        headers.get(HEADER_CONTENT_LENGTH) != "12" ||
+        headers.get(HEADER_CONNECTION) != "Keep-Alive" ||
+        headers.has(HEADER_RANGE) || !headers.get(HEADER_RANGE).empty() ||
+        !headers.find("X-FORWARDED-FOR", &value) || value != "b" ||
+        !headers.find("Content-Length", &value) || value != "12" ||
+        headers.find("Cookie", &value) || headers.size() != 5 ||
+        headers.id(1) != HEADER_OTHER || headers.name(3) != "x-forwarded-for") {
+      printf("FAIL: HttpHeaders round %d\n", round);
+      ++failed;
+    }
+  }
+  for (int id = 0; id < HEADER_KNOWN_COUNT; ++id) {
+    // 每个常用头部都要能按名字查到自己的编号
+    static const char *const names[] = {
+        "host",          "connection",        "keep-alive",
+        "proxy-connection", "content-length", "content-type",
+        "transfer-encoding", "expect",        "accept-encoding",
+        "range",         "if-range",          "if-none-match",
+        "if-modified-since"};
+    if (HttpHeaders::lookup(names[id]) != id) {
+      printf("FAIL: lookup(%s)\n", names[id]);
+      ++failed;
+    }
+  }
+  if (HttpHeaders::lookup("Hosts") != HEADER_OTHER ||
+      HttpHeaders::lookup("Content-Lengthx") != HEADER_OTHER) {
+    printf("FAIL: lookup of unknown names\n");
+    ++failed;
+  }
+  // 请求体的边界要看所有的Content-Length和Transfer-Encoding，不能只看最后一个
+  static const struct {
+    const char *fields[3][2];
+    BodyFraming framing;
+    size_t length;
+  } framings[] = {
+      {{{"Host", "a"}}, FRAMING_NONE, 0},
+      {{{"Content-Length", "5"}}, FRAMING_LENGTH, 5},
+      {{{"Content-Length", "5"}, {"content-length", "5"}}, FRAMING_LENGTH, 5},
+      {{{"Content-Length", "0"}, {"Content-Length", "5"}}, FRAMING_INVALID, 0},
+      {{{"Content-Length", "5"}, {"Content-Length", "x"}}, FRAMING_INVALID, 0},
+      {{{"Content-Length", "5, 5"}}, FRAMING_INVALID, 0},
+      {{{"Transfer-Encoding", "chunked"}}, FRAMING_CHUNKED, 0},
+      {{{"Transfer-Encoding", "gzip"}}, FRAMING_UNSUPPORTED, 0},
+      {{{"Transfer-Encoding", "chunked"}, {"Transfer-Encoding", "chunked"}},
+       FRAMING_INVALID, 0},
+      {{{"Transfer-Encoding", "gzip"}, {"Transfer-Encoding", "chunked"}},
+       FRAMING_INVALID, 0},
+      {{{"Content-Length", "5"}, {"Transfer-Encoding", "chunked"}},
+       FRAMING_INVALID, 0},
+  };
+  for (size_t i = 0; i < sizeof framings / sizeof framings[0]; ++i) {
+    headers.clear();
+    for (int j = 0; j < 3 && framings[i].fields[j][0]; ++j)
+      headers.add(framings[i].fields[j][0], framings[i].fields[j][1]);
+    size_t length = 0;
+    if (headers.bodyFraming(&length) != framings[i].framing ||
+        length != framings[i].length) {
+      printf("FAIL: bodyFraming case %zu\n", i);
+      ++failed;
+    }
+  }
+  return failed;
+}
+
+typedef bool (*ParseFunc)(const string &, HttpMethod &, HttpVersion &, string &,
+                          string &);
+
+static double bench(ParseFunc parse, const vector<string> &requests,
+                    int rounds) {
+  HttpMethod method;
+  HttpVersion version;
+  string fileName, uri;
+  long ok = 0;
+  double start = nowSeconds();
+  for (int r = 0; r < rounds; ++r)
+    for (size_t i = 0; i < requests.size(); ++i)
+      ok += parse(requests[i], method, version, fileName, uri);
+  double elapsed = nowSeconds() - start;
+  if (ok != static_cast<long>(rounds * requests.size()))
+    printf("unexpected parse failures: %ld\n", rounds * requests.size() - ok);
+  return elapsed * 1e9 / (static_cast<double>(rounds) * requests.size());
+}
+
+int main(int argc, char *argv[]) {
+  int rounds = argc > 1 ? atoi(argv[1]) : 200000;
+  HttpParser::ScanImpl best = HttpParser::scanImpl();
+  int failed = checkParser() + checkHeaderLine() + checkScanners() +
+               checkHeaders() + checkChunked();
+  HttpParser::setScanImpl(best);
+  if (failed) return 1;
+
+  // 请求行后面带上一组常见的头部，和inBuffer_里的情形一样
+  const string headers =
+      "\r\nHost: www.example.com\r\nUser-Agent: Mozilla/5.0 (X11; Linux x86_64)"
+      "\r\nAccept: text/html,application/xhtml+xml\r\nAccept-Encoding: gzip"
+      "\r\nConnection: keep-alive\r\n\r\n";
+  vector<string> requests;
+  requests.push_back("GET / HTTP/1.1" + headers);
+  requests.push_back("GET /index.html HTTP/1.1" + headers);
+  requests.push_back("GET /static/js/app.min.js?v=20231018 HTTP/1.1" + headers);
+  requests.push_back("HEAD /images/logo.png HTTP/1.0" + headers);
+  requests.push_back(
+      "POST /api/v1/users/12345/orders?expand=items&limit=50 HTTP/1.1" +
+      headers);
+
+  double legacy = bench(legacyParse, requests, rounds);
+  double parser = bench(newParse, requests, rounds);
+  printf("requests=%zu rounds=%d legacy=%.1f ns/request parser=%.1f "
+         "ns/request speedup=%.2fx\n",
+         requests.size(), rounds, legacy, parser, legacy / parser);
+
+  // 浏览器发出的一组典型头部，去掉请求行后大约1KB
+  const string block =
+      "\nHost: www.example.com\r\n"
+      "Connection: keep-alive\r\n"
+      "Cache-Control: max-age=0\r\n"
+      "sec-ch-ua: \"Chromium\";v=\"118\", \"Google Chrome\";v=\"118\"\r\n"
+      "sec-ch-ua-mobile: ?0\r\n"
+      "sec-ch-ua-platform: \"Linux\"\r\n"
+      "Upgrade-Insecure-Requests: 1\r\n"
+      "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, "
+      "like Gecko) Chrome/118.0.0.0 Safari/537.36\r\n"
+      "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/"
+      "avif,image/webp,image/apng,*/*;q=0.8\r\n"
+      "Sec-Fetch-Site: same-origin\r\n"
+      "Sec-Fetch-Mode: navigate\r\n"
+      "Sec-Fetch-User: ?1\r\n"
+      "Sec-Fetch-Dest: document\r\n"
+      "Referer: https://www.example.com/articles/2023/10/18/index.html\r\n"
+      "Accept-Encoding: gzip, deflate, br\r\n"
+      "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+      "Cookie: sessionid=8f14e45fceea167a5a36dedd4bea2543; csrftoken="
+      "c9f0f895fb98ab9159f51fd0297e236d; theme=dark; lang=zh-CN\r\n"
+      "If-None-Match: \"5f3e-18b3c1a2f40\"\r\n"
+      "If-Modified-Since: Wed, 18 Oct 2023 08:00:00 GMT\r\n"
+      "\r\n";
+  int headerRounds = rounds / 2 > 0 ? rounds / 2 : 1;
+  // 只解析和解析后保存分开统计：原来的做法每个头部要分配两个字符串和一个map结点，
+  // HttpHeaders只往复用的缓冲区里追加
+  for (int store = 0; store <= 1; ++store) {
+    const char *what = store ? "parse+store" : "parse";
+    double legacyHeader =
+        benchHeaders(legacyHeaders, block, headerRounds, store);
+    printf("headers=%zu bytes %s legacy=%.1f ns/block\n", block.size(), what,
+           legacyHeader);
+    for (int impl = HttpParser::SCAN_SCALAR; impl <= HttpParser::SCAN_AVX2;
+         ++impl) {
+      if (HttpParser::setScanImpl(static_cast<HttpParser::ScanImpl>(impl)) !=
+          impl)
+        continue;
+      double ns = benchHeaders(newHeaders, block, headerRounds, store);
+      printf("headers=%zu bytes %s %s=%.1f ns/block speedup=%.2fx\n",
+             block.size(), what,
+             HttpParser::scanImplName(static_cast<HttpParser::ScanImpl>(impl)),
+             ns, legacyHeader / ns);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,192 @@
+// @Author Wang Xin
+
+// 测试反向代理用的上游服务器，每个连接一个线程，支持keep-alive：
+//   /xxx/len      带Content-Length的响应
+//   /xxx/chunked  chunked编码的响应
+//   /xxx/close    没有长度、以关闭连接结束的响应
+//   /xxx/big?n=N  N字节的响应，用来看背压
+//   /xxx/slow?ms=N 等N毫秒再响应，用来看超时
+//   POST          原样返回请求体(Content-Length或chunked)
+// 收到重复的Content-Length/Transfer-Encoding，或者两者同时出现时回400并关闭连接，
+// 代理把有歧义的头部转发过来时能看出来
+// 每个响应都带X-Upstream-Conn头部，是这个连接的序号，可以看出代理有没有复用连接
+// 用法：ProxyStub [port]
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <string>
+
+using namespace std;
+
+static std::atomic<int> g_connId(0);
+
+static bool writeAll(int fd, const string &data) {
+  size_t sent = 0;
+  while (sent < data.size()) {
+    ssize_t n = write(fd, data.data() + sent, data.size() - sent);
+    if (n <= 0) return false;
+    sent += n;
+  }
+  return true;
+}
+
+static bool readMore(int fd, string &in) {
+  char buf[4096];
+  ssize_t n = read(fd, buf, sizeof buf);
+  if (n <= 0) return false;
+  in.append(buf, n);
+  return true;
+}
+
+static long queryParam(const string &uri, const char *name) {
+  string key = string(name) + "=";
+  size_t pos = uri.find(key);
+  return pos == string::npos ? 0 : atol(uri.c_str() + pos + key.size());
+}
+
+// name头部出现的次数，name带前面的"\r\n"和后面的':'
+static int countHeader(const string &head, const char *name) {
+  int count = 0;
+  for (const char *p = head.c_str(); (p = strcasestr(p, name)) != NULL; ++p)
+    ++count;
+  return count;
+}
+
+static void *serve(void *arg) {
+  int fd = static_cast<int>(reinterpret_cast<long>(arg));
+  int id = ++g_connId;
+  string in;
+  char buf[65536];
+  while (true) {
+    size_t headEnd;
+    while ((headEnd = in.find("\r\n\r\n")) == string::npos) {
+      ssize_t n = read(fd, buf, sizeof buf);
+      if (n <= 0) {
+        close(fd);
+        return NULL;
+      }
+      in.append(buf, n);
+    }
+    string head = in.substr(0, headEnd + 4);
+    in.erase(0, headEnd + 4);
+    string method = head.substr(0, head.find(' '));
+    size_t uriStart = head.find(' ') + 1;
+    string uri = head.substr(uriStart, head.find(' ', uriStart) - uriStart);
+    int lengths = countHeader(head, "\r\nContent-Length:");
+    int encodings = countHeader(head, "\r\nTransfer-Encoding:");
+    if (lengths > 1 || encodings > 1 || (lengths > 0 && encodings > 0)) {
+      writeAll(fd, "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\n"
+                   "Connection: close\r\n\r\n");
+      break;
+    }
+    size_t length = 0;
+    const char *cl = strcasestr(head.c_str(), "\r\nContent-Length:");
+    if (cl) length = strtoul(cl + 17, NULL, 10);
+    while (in.size() < length) {
+      ssize_t n = read(fd, buf, sizeof buf);
+      if (n <= 0) {
+        close(fd);
+        return NULL;
+      }
+      in.append(buf, n);
+    }
+    string body = in.substr(0, length);
+    in.erase(0, length);
+    // chunked的请求体：逐块取出数据，trailer忽略
+    if (strcasestr(head.c_str(), "\r\nTransfer-Encoding: chunked")) {
+      bool ok = true;
+      while (ok) {
+        size_t eol;
+        while (ok && (eol = in.find("\r\n")) == string::npos) ok = readMore(fd, in);
+        if (!ok) break;
+        size_t size = strtoul(in.c_str(), NULL, 16);
+        in.erase(0, eol + 2);
+        if (size == 0) {
+          // trailer一直到空行
+          while (ok && (eol = in.find("\r\n")) != 0) {
+            if (eol == string::npos)
+              ok = readMore(fd, in);
+            else
+              in.erase(0, eol + 2);
+          }
+          if (ok) in.erase(0, 2);
+          break;
+        }
+        while (ok && in.size() < size + 2) ok = readMore(fd, in);
+        if (ok) {
+          body.append(in, 0, size);
+          in.erase(0, size + 2);
+        }
+      }
+      if (!ok) {
+        close(fd);
+        return NULL;
+      }
+    }
+
+    string conn = "X-Upstream-Conn: " + to_string(id) + "\r\n";
+    string resp;
+    bool closeAfter = false;
+    if (method == "POST") {
+      resp = "HTTP/1.1 200 OK\r\n" + conn +
+             "Content-Length: " + to_string(body.size()) + "\r\n\r\n" + body;
+    } else if (uri.find("/chunked") != string::npos) {
+      resp = "HTTP/1.1 200 OK\r\n" + conn +
+             "Transfer-Encoding: chunked\r\n\r\n"
+             "6\r\nhello \r\n"
+             "d;ext=1\r\nfrom chunked\n\r\n"
+             "0\r\nX-Trailer: 1\r\n\r\n";
+    } else if (uri.find("/close") != string::npos) {
+      resp = "HTTP/1.1 200 OK\r\n" + conn +
+             "Connection: close\r\n\r\nclose delimited body\n";
+      closeAfter = true;
+    } else if (uri.find("/big") != string::npos) {
+      long n = queryParam(uri, "n");
+      resp = "HTTP/1.1 200 OK\r\n" + conn +
+             "Content-Length: " + to_string(n) + "\r\n\r\n" + string(n, 'x');
+    } else {
+      long ms = queryParam(uri, "ms");
+      if (ms > 0) usleep(ms * 1000);
+      string text = "hello from upstream " + uri + "\n";
+      resp = "HTTP/1.1 200 OK\r\n" + conn +
+             "Content-Type: text/plain\r\n"
+             "Content-Length: " + to_string(text.size()) + "\r\n\r\n";
+      if (method != "HEAD") resp += text;
+    }
+    if (!writeAll(fd, resp) || closeAfter) break;
+  }
+  close(fd);
+  return NULL;
+}
+
+int main(int argc, char *argv[]) {
+  int port = argc > 1 ? atoi(argv[1]) : 8081;
+  int listenFd = socket(AF_INET, SOCK_STREAM, 0);
+  int on = 1;
+  setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on);
+  struct sockaddr_in addr;
+  bzero(&addr, sizeof addr);
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (bind(listenFd, (struct sockaddr *)&addr, sizeof addr) < 0 ||
+      listen(listenFd, 128) < 0) {
+    perror("listen");
+    return 1;
+  }
+  while (true) {
+    int fd = accept(listenFd, NULL, NULL);
+    if (fd < 0) continue;
+    pthread_t tid;
+    pthread_create(&tid, NULL, serve, reinterpret_cast<void *>(fd));
+    pthread_detach(tid);
+  }
+  return 0;
+}